@@ -1,6 +1,6 @@
 workspace "simpledwrite"
     configurations { "Debug", "Release" }
-    platforms { "x64" }
+    platforms { "x64", "linux64" }
     basedir "demo"
 
 project "simpledwrite"
@@ -15,6 +15,7 @@ project "simpledwrite"
     platforms { "x64" }
 
     files { "**.cc", "**.h" }
+    removefiles { "tests/**" }
     targetdir "bin/%{cfg.buildcfg}"
     includedirs { ".", }
 
@@ -30,3 +31,110 @@ project "simpledwrite"
     filter "configurations:Release"
         defines { "NDEBUG" }
         optimize "On"
+
+-- Library with the software backend only, for Linux hosts:
+--   premake5 gmake2 && make -C demo simpledwrite_lib config=release_linux64
+project "simpledwrite_lib"
+    kind "StaticLib"
+    language "C++"
+    cppdialect "C++20"
+    location "build"
+    targetdir "build/bin/%{cfg.buildcfg}"
+    objdir "build/obj/%{cfg.buildcfg}"
+
+    platforms { "linux64" }
+
+    files { "simpledwrite*.cc", "simpledwrite*.h" }
+    includedirs { ".", }
+
+    filter { "platforms:linux64" }
+        system "Linux"
+        architecture "x86_64"
+
+    filter "configurations:Debug*"
+        defines { "_DEBUG" }
+        symbols "On"
+
+    filter "configurations:Release"
+        defines { "NDEBUG" }
+        optimize "On"
+
+-- Tests, each a program that prints OK and exits with 0 on success:
+--   make -C demo utf_test config=release_linux64 && demo/build/bin/Release/utf_test
+project "utf_test"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++20"
+    location "build"
+    targetdir "build/bin/%{cfg.buildcfg}"
+    objdir "build/obj/%{cfg.buildcfg}"
+
+    platforms { "linux64" }
+
+    files { "tests/utf_test.cc" }
+    includedirs { ".", }
+    links { "simpledwrite_lib", "pthread" }
+
+    filter { "platforms:linux64" }
+        system "Linux"
+        architecture "x86_64"
+
+    filter "configurations:Debug*"
+        defines { "_DEBUG" }
+        symbols "On"
+
+    filter "configurations:Release"
+        defines { "NDEBUG" }
+        optimize "On"
+
+project "alloc_test"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++20"
+    location "build"
+    targetdir "build/bin/%{cfg.buildcfg}"
+    objdir "build/obj/%{cfg.buildcfg}"
+
+    platforms { "linux64" }
+
+    files { "tests/alloc_test.cc" }
+    includedirs { ".", }
+    links { "simpledwrite_lib", "pthread" }
+
+    filter { "platforms:linux64" }
+        system "Linux"
+        architecture "x86_64"
+
+    filter "configurations:Debug*"
+        defines { "_DEBUG" }
+        symbols "On"
+
+    filter "configurations:Release"
+        defines { "NDEBUG" }
+        optimize "On"
+
+project "atlas_test"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++20"
+    location "build"
+    targetdir "build/bin/%{cfg.buildcfg}"
+    objdir "build/obj/%{cfg.buildcfg}"
+
+    platforms { "linux64" }
+
+    files { "tests/atlas_test.cc" }
+    includedirs { ".", }
+    links { "simpledwrite_lib", "pthread" }
+
+    filter { "platforms:linux64" }
+        system "Linux"
+        architecture "x86_64"
+
+    filter "configurations:Debug*"
+        defines { "_DEBUG" }
+        symbols "On"
+
+    filter "configurations:Release"
+        defines { "NDEBUG" }
+        optimize "On"
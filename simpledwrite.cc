@@ -1,67 +1,123 @@
 #include "simpledwrite.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include "simpledwrite_atlas.h"
+#include "simpledwrite_context.h"
+#include "simpledwrite_glyphcache.h"
+#include "simpledwrite_impl.h"
+#include "simpledwrite_lru.h"
+#include "simpledwrite_pixel.h"
+#include "simpledwrite_raster.h"
+#include "simpledwrite_sdf.h"
+#include "simpledwrite_threadpool.h"
+
+#ifdef _WIN32
 #include <combaseapi.h>
 #include <comdef.h>
-#include <d2d1_3.h>
 #include <dwrite_3.h>
 #include <shellapi.h>
 #include <shlwapi.h>
-#include <wincodec.h>
-#include <winrt/base.h>
 #include <wrl.h>
 
-#include <functional>
-#include <iostream>
-#include <mutex>
-#include <sstream>
-#include <stdexcept>
-#include <unordered_map>
-
-#pragma comment(lib, "d2d1.lib")
 #pragma comment(lib, "dwrite.lib")
 #pragma comment(lib, "shlwapi.lib")
 
-#define STR_HELPER(x) #x
-#define STR(x) STR_HELPER(x)
-#define CHECK_(hr, file, line)                                         \
-  if (FAILED(hr)) {                                                    \
-     std::string errmsg = std::system_category().message(hr);           \
-     std::stringstream ss;                                              \
-     ss << "failed at " << file << "@" << line << " reason=" << errmsg; \
-     throw std::runtime_error(ss.str());                                \
-  }
-#define CHECK(hr) CHECK_(hr, __FILE__, STR(__LINE__))
+// Kept out of line so that CHECK costs only a compare and branch when the
+// call succeeds.
+[[noreturn]] static void throw_hresult(HRESULT hr, const char* file, int line) {
+  throw simpledwrite::Error(simpledwrite::Status::SYSTEM_ERROR,
+      "failed at " + std::string(file) + "@" + std::to_string(line) +
+          " reason=" + std::system_category().message(hr));
+}
+#define CHECK(expr)                              \
+  do {                                           \
+    const HRESULT hr_ = (expr);                  \
+    if (FAILED(hr_)) {                           \
+      throw_hresult(hr_, __FILE__, __LINE__);    \
+    }                                            \
+  } while (0)
 
 using namespace Microsoft::WRL;
+#endif
 
 namespace simpledwrite {
 
-constexpr int kMaxLayoutSize = 16384;
+size_t LayoutKeyHash::operator()(const LayoutKeyRef& key) const {
+  const Layout& layout = *key.layout;
+  size_t h = std::hash<std::u16string_view>()(key.text);
+  auto mix = [&h](size_t v) {
+    h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+  };
+  mix(std::hash<int>()(layout.font_size));
+  mix(std::hash<float>()(layout.max_width));
+  mix(std::hash<float>()(layout.max_height));
+  mix((size_t)layout.word_wrap_mode << 24 | (size_t)layout.font_weight << 8 |
+      (size_t)layout.font_stretch << 4 | (size_t)layout.font_style);
+  return h;
+}
+
+bool LayoutKeyEqual::equal(const LayoutKeyRef& a, const LayoutKeyRef& b) {
+  return a.text == b.text && a.layout->font_size == b.layout->font_size &&
+         a.layout->font_weight == b.layout->font_weight &&
+         a.layout->font_style == b.layout->font_style &&
+         a.layout->font_stretch == b.layout->font_stretch &&
+         a.layout->max_width == b.layout->max_width &&
+         a.layout->max_height == b.layout->max_height &&
+         a.layout->word_wrap_mode == b.layout->word_wrap_mode;
+}
 
+#ifdef _WIN32
 inline std::string utf16_to_utf8(const std::wstring& wstr) {
-  winrt::hstring hstr(wstr);
-  return winrt::to_string(hstr);
+  return u16_to_utf8(
+      std::u16string_view((const char16_t*)wstr.data(), wstr.size()));
 }
 
 inline std::wstring utf8_to_utf16(const std::string& str) {
-  winrt::hstring hstr = winrt::to_hstring(str);
-  return (std::wstring)hstr;
+  const std::u16string u16 = utf8_to_u16(str);
+  return std::wstring((const wchar_t*)u16.data(), u16.size());
+}
+
+// Receives the baseline origin, glyphs and source text of the glyph runs
+// drawn through a TextRenderer. Passed to Draw as the client drawing
+// context. |description| is null for runs drawn without source text.
+struct GlyphRunSink {
+  void (*func)(void* context, FLOAT origin_x, FLOAT origin_y,
+      const DWRITE_GLYPH_RUN& run,
+      const DWRITE_GLYPH_RUN_DESCRIPTION* description);
+  void* context;
+};
+
+// Sink calling |func|, which must outlive it.
+template <class Func>
+GlyphRunSink make_glyph_run_sink(Func& func) {
+  auto call = [](void* context, FLOAT origin_x, FLOAT origin_y,
+                  const DWRITE_GLYPH_RUN& run,
+                  const DWRITE_GLYPH_RUN_DESCRIPTION* description) {
+    (*static_cast<Func*>(context))(origin_x, origin_y, run, description);
+  };
+  return {call, &func};
 }
 
+// Hands every glyph run to the GlyphRunSink passed as the client drawing
+// context; the sinks do the drawing.
 // ref.
 // https://stackoverflow.com/questions/66872711/directwrite-direct2d-custom-text-rendering-is-hairy
 class TextRenderer
     : public RuntimeClass<RuntimeClassFlags<ClassicCom>, IDWriteTextRenderer> {
  public:
-  TextRenderer(ComPtr<ID2D1Factory7> d2d1factory,
-      std::function<float(IDWriteFontFace*)> rendercallback)
-      : d2d1factory_(d2d1factory),
-        rendercallback_(rendercallback),
-        outline_width_(0) {
-    D2D1_STROKE_STYLE_PROPERTIES strokeprops = D2D1::StrokeStyleProperties();
-    strokeprops.lineJoin = D2D1_LINE_JOIN_ROUND;
-    d2d1factory_->CreateStrokeStyle(&strokeprops, NULL, 0, &strokestyle_);
-  }
+  TextRenderer() = default;
   virtual ~TextRenderer() = default;
 
  protected:
@@ -72,14 +128,12 @@ class TextRenderer
   }
   virtual HRESULT __stdcall GetCurrentTransform(
       void* clientDrawingContext, DWRITE_MATRIX* transform) override {
-    rendertarget_->GetTransform((D2D1_MATRIX_3X2_F*)transform);
+    *transform = DWRITE_MATRIX{1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f};
     return S_OK;
   }
   virtual HRESULT __stdcall GetPixelsPerDip(
       void* clientDrawingContext, FLOAT* pixelsPerDip) override {
-    FLOAT dpi_x, dpi_y;
-    rendertarget_->GetDpi(&dpi_x, &dpi_y);
-    *pixelsPerDip = dpi_y / 96.0f;
+    *pixelsPerDip = pixels_per_dip_;
     return S_OK;
   }
   virtual HRESULT __stdcall DrawGlyphRun(void* clientDrawingContext,
@@ -87,41 +141,11 @@ class TextRenderer
       DWRITE_MEASURING_MODE measuringMode, DWRITE_GLYPH_RUN const* glyphRun,
       DWRITE_GLYPH_RUN_DESCRIPTION const* glyphRunDescription,
       IUnknown* clientDrawingEffect) override {
-    ComPtr<ID2D1PathGeometry> pathgeometry;
-    CHECK(d2d1factory_->CreatePathGeometry(&pathgeometry));
-    ComPtr<ID2D1GeometrySink> geometrysink;
-    CHECK(pathgeometry->Open(&geometrysink));
-    CHECK(glyphRun->fontFace->GetGlyphRunOutline(glyphRun->fontEmSize,
-        glyphRun->glyphIndices, glyphRun->glyphAdvances, glyphRun->glyphOffsets,
-        glyphRun->glyphCount, glyphRun->isSideways, glyphRun->bidiLevel % 2,
-        geometrysink.Get()));
-    CHECK(geometrysink->Close());
-
-    float vertical_offset = rendercallback_(glyphRun->fontFace);
-
-    {
-      D2D1::ColorF d2d1color(
-          fill_color_.r, fill_color_.g, fill_color_.b, fill_color_.a);
-      CHECK(rendertarget_->CreateSolidColorBrush(d2d1color, &fill_brush_));
-    }
-    {
-      D2D1::ColorF d2d1color(outline_color_.r, outline_color_.g,
-          outline_color_.b, outline_color_.a);
-      CHECK(rendertarget_->CreateSolidColorBrush(d2d1color, &outline_brush_));
-    }
-
-    D2D1::Matrix3x2F transform = D2D1::Matrix3x2F(1.0f, 0.0f, 0.0f, 1.0f,
-        baselineOriginX, baselineOriginY + vertical_offset);
-    ComPtr<ID2D1TransformedGeometry> transformedgeometry;
-    CHECK(d2d1factory_->CreateTransformedGeometry(
-        pathgeometry.Get(), transform, &transformedgeometry));
-    if (outline_width_) {
-      rendertarget_->DrawGeometry(transformedgeometry.Get(),
-          outline_brush_.Get(), static_cast<FLOAT>(outline_width_),
-          strokestyle_.Get());
+    auto sink = static_cast<const GlyphRunSink*>(clientDrawingContext);
+    if (sink) {
+      sink->func(sink->context, baselineOriginX, baselineOriginY, *glyphRun,
+          glyphRunDescription);
     }
-    rendertarget_->FillGeometry(transformedgeometry.Get(), fill_brush_.Get());
-
     return S_OK;
   }
   virtual HRESULT __stdcall DrawUnderline(void* clientDrawingContext,
@@ -144,179 +168,80 @@ class TextRenderer
   }
 
  public:
-  void SetRenderTarget(ComPtr<ID2D1RenderTarget> rendertarget) {
-    rendertarget_ = rendertarget;
+  // Baseline origins are snapped to whole pixels at this scale.
+  void SetPixelsPerDip(float pixels_per_dip) {
+    pixels_per_dip_ = pixels_per_dip;
   }
-  void SetOutline(float width, Color color) {
-    outline_width_ = width;
-    outline_color_ = color;
-  };
-  void SetFill(Color color) { fill_color_ = color; };
 
  private:
-  ComPtr<ID2D1Factory7> d2d1factory_;
-  ComPtr<ID2D1RenderTarget> rendertarget_;
-  std::function<float(IDWriteFontFace*)> rendercallback_;
-
-  Color fill_color_;
-  float outline_width_ = 0.0f;
-  Color outline_color_;
-  ComPtr<ID2D1SolidColorBrush> fill_brush_;
-  ComPtr<ID2D1SolidColorBrush> outline_brush_;
-  ComPtr<ID2D1StrokeStyle> strokestyle_;
+  float pixels_per_dip_ = 1.0f;
 };
 
-class SimpleDWriteImpl {
+// Feeds glyph outlines (units of the em size, y down) into a Path, whose
+// scale maps them to pixels.
+class PathGeometrySink
+    : public RuntimeClass<RuntimeClassFlags<ClassicCom>, IDWriteGeometrySink> {
  public:
-  SimpleDWriteImpl() {
-    CHECK(::D2D1CreateFactory<ID2D1Factory7>(
-        D2D1_FACTORY_TYPE_SINGLE_THREADED, &d2d1factory));
-    CHECK(::DWriteCreateFactory(
-        DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory7), &dwritefactory));
-    CHECK(::CoCreateInstance(CLSID_WICImagingFactory2, nullptr,
-        CLSCTX_INPROC_SERVER, __uuidof(IWICImagingFactory2),
-        &wicimagingfactory));
-    textrenderer =
-        Make<TextRenderer>(d2d1factory, [=](IDWriteFontFace* ff) -> float {
-          ComPtr<IDWriteFontFace5> ff5;
-          CHECK(ff->QueryInterface<IDWriteFontFace5>(&ff5));
-          ComPtr<IDWriteLocalizedStrings> names;
-          CHECK(ff5->GetFamilyNames(&names));
-          static wchar_t buf[1024];
-          CHECK(names->GetString(0, buf, 1024));
-          std::wstring wstr(buf);
-          if (fontfamilymap.count(wstr)) {
-            float offset = fontfamilymap.at(wstr)->vertical_offset;
-            return offset;
-          }
-          return 0.0f;
-        });
-  }
-  virtual ~SimpleDWriteImpl() = default;
-
-  bool calcSize(ComPtr<IDWriteTextLayout> textlayout, Layout& layout) {
-    DWRITE_TEXT_METRICS text_metrics{};
-    CHECK(textlayout->GetMetrics(&text_metrics));
-    const size_t required_size = (int)(text_metrics.width + 0.5f) * 4 *
-                                 (int)(text_metrics.height + 0.5f);
-    layout.out_buffer_size = (int)required_size;
-
-    DWRITE_OVERHANG_METRICS overhang_metrics{};
-    CHECK(textlayout->GetOverhangMetrics(&overhang_metrics));
-    layout.out_width = (int)(text_metrics.width + 0.5f);
-    layout.out_height = (int)(text_metrics.height + 0.5f);
-    layout.out_padding_top = (int)(-std::min(0.0f, overhang_metrics.top));
-    layout.out_padding_left = (int)(-std::min(0.0f, overhang_metrics.left));
-    layout.out_padding_right = layout.out_width - (int)(layout.max_width + overhang_metrics.right);
-    layout.out_padding_bottom = layout.out_height - (int)(layout.max_height + overhang_metrics.bottom);
-
-    std::vector<DWRITE_LINE_METRICS> line_metrics(text_metrics.lineCount);
-    UINT32 line_count = 0;
-    CHECK(textlayout->GetLineMetrics(
-        line_metrics.data(), (UINT32)line_metrics.size(), &line_count));
+  explicit PathGeometrySink(Path* path) : path_(path) {}
+  virtual ~PathGeometrySink() = default;
 
-    if (!line_metrics.empty()) {
-      layout.out_baseline =
-          (int)(line_metrics.front().baseline - overhang_metrics.top + 0.5f);
+  virtual void __stdcall SetFillMode(D2D1_FILL_MODE fillMode) override {}
+  virtual void __stdcall SetSegmentFlags(
+      D2D1_PATH_SEGMENT vertexFlags) override {}
+  virtual void __stdcall BeginFigure(
+      D2D1_POINT_2F startPoint, D2D1_FIGURE_BEGIN figureBegin) override {
+    path_->moveTo(startPoint.x, -startPoint.y);
+  }
+  virtual void __stdcall AddLines(
+      const D2D1_POINT_2F* points, UINT32 pointsCount) override {
+    for (UINT32 i = 0; i < pointsCount; ++i) {
+      path_->lineTo(points[i].x, -points[i].y);
     }
-
-    return true;
   }
-
-  ComPtr<IDWriteTextFormat> createTextFormat(const Layout& layout, const FontSet& fs, float dpi) {
-    ComPtr<IDWriteTextFormat> textformat;
-    const float dip = layout.font_size / (dpi / 96.0f);
-    CHECK(dwritefactory->CreateTextFormat(firstfamilyname.c_str(),
-        fontcollection.Get(), (DWRITE_FONT_WEIGHT)layout.font_weight,
-        (DWRITE_FONT_STYLE)layout.font_style,
-        (DWRITE_FONT_STRETCH)layout.font_stretch, dip,
-        utf8_to_utf16(fs.locale).c_str(), &textformat));
-    if (fallback) {
-      ComPtr<IDWriteTextFormat3> textformat3;
-      textformat.As(&textformat3);
-      CHECK(textformat3->SetFontFallback(fallback.Get()));
+  virtual void __stdcall AddBeziers(
+      const D2D1_BEZIER_SEGMENT* beziers, UINT32 beziersCount) override {
+    for (UINT32 i = 0; i < beziersCount; ++i) {
+      const D2D1_BEZIER_SEGMENT& bezier = beziers[i];
+      path_->cubicTo(bezier.point1.x, -bezier.point1.y, bezier.point2.x,
+          -bezier.point2.y, bezier.point3.x, -bezier.point3.y);
     }
-    return textformat;
   }
-
-  ComPtr<IDWriteTextLayout> createTextLayout(ComPtr<IDWriteTextFormat> textformat,
-      const Layout& layout, const std::string& text) {
-    std::wstring wtext = utf8_to_utf16(text);
-    ComPtr<IDWriteTextLayout> textlayout;
-    CHECK(dwritefactory->CreateTextLayout(wtext.c_str(), (UINT32)wtext.length(),
-        textformat.Get(), (FLOAT)layout.max_width, (FLOAT)layout.max_height,
-        &textlayout));
-    textlayout->SetWordWrapping((DWRITE_WORD_WRAPPING)layout.word_wrap_mode);
-    return textlayout;
+  virtual void __stdcall EndFigure(D2D1_FIGURE_END figureEnd) override {
+    path_->close();
   }
+  virtual HRESULT __stdcall Close() override { return S_OK; }
 
-  ComPtr<ID2D1Factory7> d2d1factory;
-  ComPtr<IDWriteFactory7> dwritefactory;
-  ComPtr<IWICImagingFactory2> wicimagingfactory;
-  ComPtr<IDWriteFontSet> fontset;
-  ComPtr<IDWriteFontCollection1> fontcollection;
-  ComPtr<IDWriteFontFallback> fallback;
-  ComPtr<TextRenderer> textrenderer;
-  ComPtr<IWICBitmap> wicbitmap;
-  std::unordered_map<std::wstring, Font*> fontfamilymap;
-  std::wstring firstfamilyname;
+ private:
+  Path* path_;
 };
 
-Font::Font(const std::string& name, float vertical_offset)
-    : name(name), data(), data_size(), vertical_offset(vertical_offset) {}
-
-Font::Font(const void* data, size_t data_size, float vertical_offset)
-    : name(),
-      data(data),
-      data_size(data_size),
-      vertical_offset(vertical_offset) {}
-
-FallbackFont::FallbackFont(const std::string& family,
-    const std::vector<std::pair<uint32_t, uint32_t>>& ranges)
-    : family(family), ranges(ranges) {}
-
-FontSet FontSet::Default() {
-  static FontSet fontset;
-  static std::once_flag once;
-  std::call_once(once, [&] {
-    wchar_t locale[LOCALE_NAME_MAX_LENGTH];
-    int ret = ::GetUserDefaultLocaleName(locale, LOCALE_NAME_MAX_LENGTH);
-    fontset.locale = utf16_to_utf8(locale);
-  });
-  return fontset;
-}
-
-FontSet::FontSet() {}
-
-SimpleDWrite::SimpleDWrite()
-    : dpi_((float)::GetDpiForSystem()), impl(new SimpleDWriteImpl()) {}
-
-SimpleDWrite::~SimpleDWrite() {}
-
-bool SimpleDWrite::Init(const FontSet& fs, float dpi) {
-  fs_ = fs;
-  dpi_ = dpi;
+class DWriteImpl : public SimpleDWriteImpl {
+ public:
+  DWriteImpl() {
+    CHECK(::DWriteCreateFactory(
+        DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory7), &dwritefactory));
+  }
+  virtual ~DWriteImpl() = default;
 
-  try {
+  bool init(FontSet& fs, float dpi) override {
     if (fs.locale.empty()) {
       wchar_t locale[LOCALE_NAME_MAX_LENGTH];
       int ret = ::GetUserDefaultLocaleName(locale, LOCALE_NAME_MAX_LENGTH);
       if (ret) {
-        fs_.locale = utf16_to_utf8(locale);
+        fs.locale = utf16_to_utf8(locale);
       }
     }
 
-    if (fs_.fonts.empty()) {
+    if (fs.fonts.empty()) {
       // ref. https://stackoverflow.com/questions/41505151/how-to-draw-text-with-the-default-ui-font-in-directwrite
       NONCLIENTMETRICSW ncm{sizeof(ncm)};
       BOOL ret = ::SystemParametersInfoW(SPI_GETNONCLIENTMETRICS, ncm.cbSize, &ncm, 0);
       if (ret == FALSE) {
-        last_error_ = "failed ::SystemParametersInfoW().";
-        return false;
+        throw Error(Status::SYSTEM_ERROR, "failed ::SystemParametersInfoW().");
       }
 
       ComPtr<IDWriteGdiInterop> gdiinterop;
-      CHECK(impl->dwritefactory->GetGdiInterop(&gdiinterop));
+      CHECK(dwritefactory->GetGdiInterop(&gdiinterop));
       ComPtr<IDWriteFont> sysfont;
       CHECK(gdiinterop->CreateFontFromLOGFONT(&ncm.lfMessageFont, &sysfont));
 
@@ -326,10 +251,10 @@ bool SimpleDWrite::Init(const FontSet& fs, float dpi) {
       CHECK(family->GetFamilyNames(&familyname));
       thread_local wchar_t buf[1024]{};
       CHECK(familyname->GetString(0, buf, 1024));
-      fs_.fonts.push_back(Font(utf16_to_utf8(buf)));
+      fs.fonts.push_back(Font(utf16_to_utf8(buf)));
     }
 
-    ComPtr<IDWriteFactory7> factory = impl->dwritefactory;
+    ComPtr<IDWriteFactory7> factory = dwritefactory;
     ComPtr<IDWriteInMemoryFontFileLoader> memoryfontfileloader;
     CHECK(factory->CreateInMemoryFontFileLoader(&memoryfontfileloader));
     CHECK(factory->RegisterFontFileLoader(memoryfontfileloader.Get()));
@@ -339,7 +264,7 @@ bool SimpleDWrite::Init(const FontSet& fs, float dpi) {
     CHECK(factory->GetSystemFontCollection(&systemfontcollection));
 
     std::vector<Font*> fontconfiglist;
-    for (const Font& font : fs_.fonts) {
+    for (const Font& font : fs.fonts) {
       if (font.data != nullptr && font.data_size) {
         ComPtr<IDWriteFontFile> fontfile;
         CHECK(memoryfontfileloader->CreateInMemoryFontFileReference(
@@ -357,8 +282,7 @@ bool SimpleDWrite::Init(const FontSet& fs, float dpi) {
             fontconfiglist.end(), (size_t)faces, (Font*)&font);
       } else {
         if (font.name.empty()) {
-          last_error_ = "Font::name is empty.";
-          return false;
+          throw Error(Status::INVALID_ARGUMENT, "Font::name is empty.");
         }
 
         UINT32 index = 0;
@@ -391,34 +315,48 @@ bool SimpleDWrite::Init(const FontSet& fs, float dpi) {
       }
     }
 
-    CHECK(fontsetbuilder->CreateFontSet(&impl->fontset));
+    contexts.clear();
+    CHECK(fontsetbuilder->CreateFontSet(&fontset));
     CHECK(factory->CreateFontCollectionFromFontSet(
-        impl->fontset.Get(), &impl->fontcollection));
-    impl->firstfamilyname.clear();
+        fontset.Get(), &fontcollection));
+    firstfamilyname.clear();
+    fontfamilymap.clear();
+    faceoffsets.clear();
     for (int i = 0; i < (int)fontconfiglist.size(); ++i) {
       ComPtr<IDWriteFontFamily1> fontfamily;
-      CHECK(impl->fontcollection->GetFontFamily(i, &fontfamily));
+      CHECK(fontcollection->GetFontFamily(i, &fontfamily));
       ComPtr<IDWriteLocalizedStrings> names;
       CHECK(fontfamily->GetFamilyNames(&names));
       UINT32 count = names->GetCount();
       thread_local wchar_t familyname[1024];
       if (i == 0) {
         CHECK(names->GetString(0, familyname, 1024));
-        impl->firstfamilyname = familyname;
+        firstfamilyname = familyname;
       }
       for (UINT32 j = 0; j < count; ++j) {
         CHECK(names->GetString(j, familyname, 1024));
       }
-      impl->fontfamilymap[familyname] = fontconfiglist[i];
+      fontfamilymap[familyname] = fontconfiglist[i];
+
+      // Font faces are cached by DirectWrite, so the faces created here are
+      // the ones glyph runs of this family will carry.
+      for (UINT32 j = 0; j < fontfamily->GetFontCount(); ++j) {
+        ComPtr<IDWriteFont> font;
+        CHECK(fontfamily->GetFont(j, &font));
+        ComPtr<IDWriteFontFace> fontface;
+        CHECK(font->CreateFontFace(&fontface));
+        faceoffsets[fontface.Get()] = {
+            fontface, fontconfiglist[i]->vertical_offset};
+      }
     }
-    if (impl->firstfamilyname.empty()) {
-      last_error_ = "font not found.";
-      return false;
+    if (firstfamilyname.empty()) {
+      throw Error(Status::FONT_NOT_FOUND, "font not found.");
     }
+    familyfonts.assign(fontconfiglist.begin(), fontconfiglist.end());
 
     ComPtr<IDWriteFontFallbackBuilder> fallbackbuilder;
     CHECK(factory->CreateFontFallbackBuilder(&fallbackbuilder));
-    for (const FallbackFont& fallback : fs_.fallbacks) {
+    for (const FallbackFont& fallback : fs.fallbacks) {
       std::vector<DWRITE_UNICODE_RANGE> ranges;
       for (const std::pair<uint32_t, uint32_t>& pair : fallback.ranges) {
         DWRITE_UNICODE_RANGE range{};
@@ -430,101 +368,1317 @@ bool SimpleDWrite::Init(const FontSet& fs, float dpi) {
       const wchar_t* wfamilyptr = wfamily.c_str();
       CHECK(fallbackbuilder->AddMapping(
           (const DWRITE_UNICODE_RANGE*)ranges.data(), (UINT32)ranges.size(),
-          (const WCHAR**)&wfamilyptr, 1, impl->fontcollection.Get()));
+          (const WCHAR**)&wfamilyptr, 1, fontcollection.Get()));
     }
-    CHECK(fallbackbuilder->CreateFontFallback(&impl->fallback));
+    CHECK(fallbackbuilder->CreateFontFallback(&fallback));
     return true;
-  } catch (std::exception& ex) {
-    last_error_ = ex.what();
-    return false;
   }
-  return false;
-}
 
-bool SimpleDWrite::CalcSize(const std::string& text, Layout& layout) const {
-  try {
-    ComPtr<IDWriteTextFormat> textformat = impl->createTextFormat(layout, fs_, dpi_);
-    ComPtr<IDWriteTextLayout> textlayout = impl->createTextLayout(textformat, layout, text);
-    if (!impl->calcSize(textlayout, layout)) {
+  void setGlyphCacheBudget(size_t bytes) override {
+    glyphcachebudget = bytes;
+    contexts.forEach(
+        [bytes](Context& ctx) { ctx.glyphcache.setBudget(bytes); });
+  }
+
+  GlyphCacheStats glyphCacheStats() const override {
+    GlyphCacheStats stats;
+    contexts.forEach([&stats](Context& ctx) {
+      const GlyphCacheStats context_stats = ctx.glyphcache.stats();
+      stats.entries += context_stats.entries;
+      stats.bytes += context_stats.bytes;
+      stats.hits += context_stats.hits;
+      stats.misses += context_stats.misses;
+      stats.evictions += context_stats.evictions;
+    });
+    stats.budget = glyphcachebudget;
+    return stats;
+  }
+
+  void setLayoutCacheCapacity(size_t entries) override {
+    layoutcachecapacity = entries;
+    contexts.forEach(
+        [entries](Context& ctx) { ctx.layoutcache.setCapacity(entries); });
+  }
+
+  LayoutCacheStats layoutCacheStats() const override {
+    LayoutCacheStats stats;
+    contexts.forEach([&stats](Context& ctx) {
+      stats.entries += ctx.layoutcache.size();
+      stats.hits += ctx.layoutcache.hits();
+      stats.misses += ctx.layoutcache.misses();
+    });
+    stats.capacity = layoutcachecapacity;
+    return stats;
+  }
+
+  void trim() override {
+    contexts.forEach([](Context& ctx) {
+      ctx.rasterizer = Rasterizer();
+      ctx.path = Path();
+      ctx.stroke = Path();
+      ctx.mask = GlyphMask();
+      ctx.fillmask = std::vector<uint8_t>();
+      ctx.outlinemask = std::vector<uint8_t>();
+      ctx.pixels = std::vector<uint8_t>();
+      ctx.advances = std::vector<FLOAT>();
+      ctx.glyphmetrics = std::vector<DWRITE_GLYPH_METRICS>();
+    });
+  }
+
+  bool calcSize(const FontSet& fs, float dpi, std::u16string_view text,
+      Layout& layout) override {
+    ContextPool<Context>::Lease ctx = contexts.acquire();
+    ComPtr<IDWriteTextLayout> textlayout =
+        cachedTextLayout(*ctx, layout, fs, dpi, text);
+    return calcSize(*ctx, textlayout, layout);
+  }
+
+  void calcSizes(const FontSet& fs, float dpi,
+      std::span<const std::string> texts, size_t begin, size_t end,
+      const Layout& layout, BatchMetrics& metrics) override {
+    ContextPool<Context>::Lease ctx = contexts.acquire();
+    std::exception_ptr error;
+    Layout out = layout;
+    std::u16string text;
+    for (size_t i = begin; i < end; ++i) {
+      try {
+        utf8_to_u16(texts[i], text);
+        ComPtr<IDWriteTextLayout> textlayout =
+            cachedTextLayout(*ctx, layout, fs, dpi, text);
+        if (calcSize(*ctx, textlayout, out)) {
+          store_metrics(out, i, metrics);
+        }
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  bool render(const FontSet& fs, float dpi, std::u16string_view text,
+      uint8_t* buffer, int buffer_size, Layout& layout,
+      const RenderParams& renderparams) override {
+    ContextPool<Context>::Lease ctx = contexts.acquire();
+    ComPtr<IDWriteTextLayout> textlayout =
+        cachedTextLayout(*ctx, layout, fs, dpi, text);
+    Surface surface;
+    if (!calcSize(*ctx, textlayout, layout) ||
+        !bufferSurface(buffer, buffer_size, layout, renderparams, surface)) {
       return false;
     }
+    draw(*ctx, dpi, surface, 0, 0, layout, renderparams, true,
+        [&](IDWriteTextRenderer* renderer, GlyphRunSink* sink) {
+          CHECK(textlayout->Draw(sink, renderer, 0.0f, 0.0f));
+        });
     return true;
-  } catch (std::exception& ex) {
-    last_error_ = ex.what();
-    return false;
   }
-}
 
-bool SimpleDWrite::Render(const std::string& text, uint8_t* buffer,
-    int buffer_size, Layout& layout, const RenderParams& renderparams) const {
-  try {
-    ComPtr<IDWriteTextFormat> textformat = impl->createTextFormat(layout, fs_, dpi_);
-    ComPtr<IDWriteTextLayout> textlayout = impl->createTextLayout(textformat, layout, text);
-    if (!impl->calcSize(textlayout, layout)) {
+  bool renderInto(const FontSet& fs, float dpi, std::u16string_view text,
+      const Surface& surface, int x, int y, Layout& layout,
+      const RenderParams& renderparams) override {
+    ContextPool<Context>::Lease ctx = contexts.acquire();
+    ComPtr<IDWriteTextLayout> textlayout =
+        cachedTextLayout(*ctx, layout, fs, dpi, text);
+    if (!calcSize(*ctx, textlayout, layout)) {
       return false;
     }
+    draw(*ctx, dpi, surface, x, y, layout, renderparams, true,
+        [&](IDWriteTextRenderer* renderer, GlyphRunSink* sink) {
+          CHECK(textlayout->Draw(sink, renderer, 0.0f, 0.0f));
+        });
+    return true;
+  }
 
-    if (layout.out_buffer_size > buffer_size) {
-      last_error_ = "not enough buffer size.";
+  bool renderGlyphRun(const FontSet& fs, float dpi, const GlyphRun& glyphrun,
+      uint8_t* buffer, int buffer_size, Layout& layout,
+      const RenderParams& renderparams) override {
+    const Font* font = &fs.fonts[glyphrun.font_index];
+    auto it = std::find(familyfonts.begin(), familyfonts.end(), font);
+    if (it == familyfonts.end()) {
+      throw Error(Status::FONT_NOT_FOUND, "font not found.");
+    }
+    ComPtr<IDWriteFontFamily1> fontfamily;
+    CHECK(fontcollection->GetFontFamily(
+        (UINT32)(it - familyfonts.begin()), &fontfamily));
+    ComPtr<IDWriteFont> dwritefont;
+    CHECK(fontfamily->GetFirstMatchingFont(
+        (DWRITE_FONT_WEIGHT)layout.font_weight,
+        (DWRITE_FONT_STRETCH)layout.font_stretch,
+        (DWRITE_FONT_STYLE)layout.font_style, &dwritefont));
+    ComPtr<IDWriteFontFace> fontface;
+    CHECK(dwritefont->CreateFontFace(&fontface));
+
+    DWRITE_FONT_METRICS metrics{};
+    fontface->GetMetrics(&metrics);
+    const float dip = layout.font_size / (dpi / 96.0f);
+    const float scale = dip / metrics.designUnitsPerEm;
+
+    ContextPool<Context>::Lease lease = contexts.acquire();
+    Context& ctx = *lease;
+    std::vector<FLOAT>& advances = ctx.advances;
+    advances.resize(glyphrun.glyph_count);
+    if (glyphrun.glyph_advances) {
+      std::copy(glyphrun.glyph_advances,
+          glyphrun.glyph_advances + glyphrun.glyph_count, advances.begin());
+    } else if (glyphrun.glyph_count) {
+      std::vector<DWRITE_GLYPH_METRICS>& glyphmetrics = ctx.glyphmetrics;
+      glyphmetrics.resize(glyphrun.glyph_count);
+      CHECK(fontface->GetDesignGlyphMetrics(glyphrun.glyph_indices,
+          glyphrun.glyph_count, glyphmetrics.data(), FALSE));
+      for (UINT32 i = 0; i < glyphrun.glyph_count; ++i) {
+        advances[i] = glyphmetrics[i].advanceWidth * scale;
+      }
+    }
+
+    DWRITE_GLYPH_RUN run{};
+    run.fontFace = fontface.Get();
+    run.fontEmSize = dip;
+    run.glyphCount = glyphrun.glyph_count;
+    run.glyphIndices = glyphrun.glyph_indices;
+    run.glyphAdvances = advances.data();
+    run.glyphOffsets = (const DWRITE_GLYPH_OFFSET*)glyphrun.glyph_offsets;
+
+    // Ink bounds from the outline, relative to the baseline origin.
+    ctx.path.reset(1.0f, 0.0f, 0.0f);
+    CHECK(fontface->GetGlyphRunOutline(run.fontEmSize, run.glyphIndices,
+        run.glyphAdvances, run.glyphOffsets, run.glyphCount, FALSE, FALSE,
+        ctx.pathsink.Get()));
+    float ink_left, ink_top, ink_right, ink_bottom;
+    ctx.path.bounds(ink_left, ink_top, ink_right, ink_bottom);
+
+    float width = 0.0f;
+    for (FLOAT advance : advances) {
+      width += advance;
+    }
+    width = std::min(std::max(width, 0.0f), (float)kMaxLayoutSize);
+    const float baseline = metrics.ascent * scale;
+    const float height = std::min(
+        (metrics.ascent + metrics.descent + metrics.lineGap) * scale,
+        (float)kMaxLayoutSize);
+
+    // Same arithmetic as calcSize(), with the overhang taken from the ink
+    // bounds relative to the max_width x max_height box.
+    const float overhang_left = -ink_left;
+    const float overhang_top = -(baseline + ink_top);
+    const float overhang_right = ink_right - layout.max_width;
+    const float overhang_bottom = baseline + ink_bottom - layout.max_height;
+    layout.out_buffer_size = (int)(width + 0.5f) * 4 * (int)(height + 0.5f);
+    layout.out_width = (int)(width + 0.5f);
+    layout.out_height = (int)(height + 0.5f);
+    layout.out_padding_top = (int)(-std::min(0.0f, overhang_top));
+    layout.out_padding_left = (int)(-std::min(0.0f, overhang_left));
+    layout.out_padding_right = layout.out_width - (int)(layout.max_width + overhang_right);
+    layout.out_padding_bottom = layout.out_height - (int)(layout.max_height + overhang_bottom);
+    layout.out_baseline = (int)(baseline - overhang_top + 0.5f);
+
+    Surface surface;
+    if (!bufferSurface(buffer, buffer_size, layout, renderparams, surface)) {
       return false;
     }
+    draw(ctx, dpi, surface, 0, 0, layout, renderparams, true,
+        [&](IDWriteTextRenderer* renderer, GlyphRunSink* sink) {
+          CHECK(renderer->DrawGlyphRun(sink, 0.0f, baseline,
+              DWRITE_MEASURING_MODE_NATURAL, &run, NULL, NULL));
+        });
+    return true;
+  }
+
+  bool rasterizeGlyph(const FontSet& fs, float dpi, uint32_t codepoint,
+      const AtlasParams& params, GlyphImage& image) override {
+    ContextPool<Context>::Lease lease = contexts.acquire();
+    Context& ctx = *lease;
+    const Layout& layout = params.layout;
+    const RenderParams& renderparams = params.renderparams;
+    std::u16string text;
+    if (codepoint >= 0x10000) {
+      text.push_back((char16_t)(0xd800 + ((codepoint - 0x10000) >> 10)));
+      text.push_back((char16_t)(0xdc00 + ((codepoint - 0x10000) & 0x3ff)));
+    } else {
+      text.push_back((char16_t)codepoint);
+    }
+    // A 0 x 0 box makes the overhangs the ink bounds around the origin.
+    Layout glyphlayout = layout;
+    glyphlayout.max_width = 0.0f;
+    glyphlayout.max_height = 0.0f;
+    glyphlayout.word_wrap_mode = WordWrapMode::NO_WRAP;
+    ComPtr<IDWriteTextLayout> textlayout = createTextLayout(
+        createTextFormat(ctx, layout, fs, dpi), glyphlayout, text);
 
-    ComPtr<IWICBitmap> bitmap;
-    CHECK(impl->wicimagingfactory->CreateBitmapFromMemory(
-        (UINT)(layout.out_width + 0.5f), (UINT)(layout.out_height + 0.5f),
-        GUID_WICPixelFormat32bppPBGRA, (UINT)(layout.out_width + 0.5f) * 4,
-        (UINT)(layout.out_width + 0.5f) * 4 * (UINT)(layout.out_height + 0.5f),
-        buffer, &bitmap));
-
-    ComPtr<ID2D1RenderTarget> rendertarget;
-    D2D1_RENDER_TARGET_PROPERTIES props =
-        D2D1::RenderTargetProperties(D2D1_RENDER_TARGET_TYPE_DEFAULT,
-            D2D1::PixelFormat(
-                DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED),
-            (FLOAT)dpi_, (FLOAT)dpi_);
-    CHECK(impl->d2d1factory->CreateWicBitmapRenderTarget(
-        bitmap.Get(), &props, &rendertarget));
-    impl->textrenderer->SetRenderTarget(rendertarget);
-
-    rendertarget->BeginDraw();
-    rendertarget->Clear(D2D1::ColorF(renderparams.background_color.r,
-        renderparams.background_color.g, renderparams.background_color.b,
-        renderparams.background_color.a));
-    rendertarget->SetTextAntialiasMode(static_cast<D2D1_TEXT_ANTIALIAS_MODE>(
-        renderparams.text_antialias_mode));
-    rendertarget->SetAntialiasMode(
-        static_cast<D2D1_ANTIALIAS_MODE>(renderparams.antialias_mode));
-    rendertarget->SetTransform(D2D1::Matrix3x2F::Identity());
-    ComPtr<ID2D1SolidColorBrush> brush;
-
-    rendertarget->CreateSolidColorBrush(
-        D2D1::ColorF(1.0f, 1.0f, 1.0f, 1.0f), &brush);
-    impl->textrenderer->SetFill(renderparams.foreground_color);
-    impl->textrenderer->SetOutline(
-        renderparams.outline_width, renderparams.outline_color);
-    textlayout->Draw(
-        NULL, (IDWriteTextRenderer*)impl->textrenderer.Get(), 0.0f, 0.0f);
-    rendertarget->EndDraw();
-
-    WICRect rect{};
-    rect.X = 0;
-    rect.Y = 0;
-    rect.Width = (INT)layout.out_width;
-    rect.Height = (INT)layout.out_height;
-    const int stride = ((INT)(layout.out_width + 0.5f)) * 4;
-    if (rect.Width * 4 * rect.Height > buffer_size) {
-      last_error_ = "not enough buffer size.";
+    // Find the face fallback picked from the glyph run it draws; the layout
+    // keeps the face alive.
+    IDWriteFontFace* fontface = nullptr;
+    auto findface = [&fontface](FLOAT, FLOAT, const DWRITE_GLYPH_RUN& run,
+                        const DWRITE_GLYPH_RUN_DESCRIPTION*) {
+      fontface = run.fontFace;
+    };
+    GlyphRunSink facesink = make_glyph_run_sink(findface);
+    CHECK(textlayout->Draw(&facesink,
+        (IDWriteTextRenderer*)ctx.textrenderer.Get(), 0.0f, 0.0f));
+    if (!fontface) {
+      return false;
+    }
+    UINT16 glyphindex = 0;
+    CHECK(fontface->GetGlyphIndices(&codepoint, 1, &glyphindex));
+    if (glyphindex == 0) {
       return false;
     }
-    CHECK(bitmap->CopyPixels(&rect, rect.Width * 4 /* dst stride */,
-        static_cast<UINT>(buffer_size), buffer));
+
+    const float scale = dpi / 96.0f;
+    DWRITE_TEXT_METRICS text_metrics{};
+    CHECK(textlayout->GetMetrics(&text_metrics));
+    DWRITE_LINE_METRICS line_metrics{};
+    UINT32 line_count = 0;
+    CHECK(textlayout->GetLineMetrics(&line_metrics, 1, &line_count));
+    DWRITE_OVERHANG_METRICS overhang_metrics{};
+    CHECK(textlayout->GetOverhangMetrics(&overhang_metrics));
+    image.advance = text_metrics.widthIncludingTrailingWhitespace * scale;
+    image.vertical_offset = verticalOffset(fontface) * scale;
+
+    if (params.mode != AtlasMode::COVERAGE) {
+      ctx.path.reset(scale, 0.0f, 0.0f);
+      CHECK(fontface->GetGlyphRunOutline(layout.font_size / scale,
+          &glyphindex, NULL, NULL, 1, FALSE, FALSE, ctx.pathsink.Get()));
+      rasterize_sdf(ctx.path, params.sdf_range,
+          params.mode == AtlasMode::MSDF, ctx.rasterizer, image);
+      return true;
+    }
+
+    const float baseline = line_metrics.baseline;
+    const float ink_left = -overhang_metrics.left;
+    const float ink_right = overhang_metrics.right;
+    if (ink_left >= ink_right) {
+      image.left = image.top = image.width = image.height = 0;
+      image.pixels.clear();
+      return true;
+    }
+    // Room for the stroke and antialiasing, relative to the baseline.
+    const float pad = renderparams.outline_width / 2.0f + 1.0f / scale;
+    image.left = (int)std::floor((ink_left - pad) * scale);
+    image.top =
+        (int)std::floor((-overhang_metrics.top - baseline - pad) * scale);
+    image.width = (int)std::ceil((ink_right + pad) * scale) - image.left;
+    image.height =
+        (int)std::ceil((overhang_metrics.bottom - baseline + pad) * scale) -
+        image.top;
+    const int bpp = BytesPerPixel(renderparams.pixel_format);
+    image.pixels.assign((size_t)image.width * image.height * bpp, 0);
+
+    Surface surface;
+    surface.data = image.pixels.data();
+    surface.stride = image.width * bpp;
+    surface.width = image.width;
+    surface.height = image.height;
+    Layout drawlayout;
+    drawlayout.out_width = image.width;
+    drawlayout.out_height = image.height;
+    RenderParams drawparams = renderparams;
+    drawparams.background_color = Color{0.0f, 0.0f, 0.0f, 0.0f};
+    const float origin_x = -image.left / scale;
+    const float origin_y = -image.top / scale - baseline;
+    draw(ctx, dpi, surface, 0, 0, drawlayout, drawparams, false,
+        [&](IDWriteTextRenderer* renderer, GlyphRunSink* sink) {
+          CHECK(textlayout->Draw(sink, renderer, origin_x, origin_y));
+        });
     return true;
-  } catch (std::exception& ex) {
-    last_error_ = ex.what();
-    return false;
   }
+
+  bool placeGlyphs(const FontSet& fs, float dpi, std::u16string_view text,
+      Layout& layout, std::vector<PlacedGlyph>& glyphs) override {
+    ContextPool<Context>::Lease lease = contexts.acquire();
+    Context& ctx = *lease;
+    ComPtr<IDWriteTextLayout> textlayout =
+        cachedTextLayout(ctx, layout, fs, dpi, text);
+    if (!calcSize(ctx, textlayout, layout)) {
+      return false;
+    }
+    const float scale = dpi / 96.0f;
+    glyphs.clear();
+    std::vector<float>& pens = ctx.pens;
+    auto placerun = [&](FLOAT origin_x, FLOAT origin_y,
+        const DWRITE_GLYPH_RUN& run,
+        const DWRITE_GLYPH_RUN_DESCRIPTION* run_description) {
+      if (!run_description) {
+        return;
+      }
+      const DWRITE_GLYPH_RUN_DESCRIPTION& description = *run_description;
+      // Glyph origins; odd bidi levels advance right to left.
+      const bool rtl = run.bidiLevel % 2;
+      float pen = origin_x;
+      pens.resize(run.glyphCount);
+      for (UINT32 i = 0; i < run.glyphCount; ++i) {
+        if (rtl) {
+          pen -= run.glyphAdvances[i];
+        }
+        const float offset =
+            run.glyphOffsets ? run.glyphOffsets[i].advanceOffset : 0.0f;
+        pens[i] = rtl ? pen - offset : pen + offset;
+        if (!rtl) {
+          pen += run.glyphAdvances[i];
+        }
+      }
+      // Every codepoint goes at the first glyph of its cluster.
+      for (UINT32 i = 0; i < description.stringLength; ++i) {
+        const UINT16 cluster = description.clusterMap[i];
+        uint32_t c = description.string[i];
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < description.stringLength &&
+            description.string[i + 1] >= 0xdc00 &&
+            description.string[i + 1] < 0xe000) {
+          c = 0x10000 + ((c - 0xd800) << 10) +
+              (description.string[++i] - 0xdc00);
+        }
+        if (cluster >= run.glyphCount) {
+          continue;
+        }
+        PlacedGlyph glyph;
+        glyph.codepoint = c;
+        glyph.x = pens[cluster] * scale;
+        glyph.y = origin_y * scale;
+        glyphs.push_back(glyph);
+      }
+    };
+    GlyphRunSink sink = make_glyph_run_sink(placerun);
+    ctx.textrenderer->SetPixelsPerDip(scale);
+    CHECK(textlayout->Draw(
+        &sink, (IDWriteTextRenderer*)ctx.textrenderer.Get(), 0.0f, 0.0f));
+    return true;
+  }
+
+ private:
+  // Per-call renderer, scratch buffers and caches; DirectWrite layouts are
+  // not safe to share between threads.
+  struct Context {
+    ComPtr<TextRenderer> textrenderer;
+    ComPtr<PathGeometrySink> pathsink;  // feeds |path|
+    Rasterizer rasterizer;
+    Path path;
+    Path stroke;
+    GlyphMask mask;
+    GlyphCache glyphcache;
+    std::unordered_map<TextFormatKey, ComPtr<IDWriteTextFormat>,
+        TextFormatKeyHash>
+        textformats;
+    LruCache<LayoutKey, ComPtr<IDWriteTextLayout>, LayoutKeyHash,
+        LayoutKeyEqual>
+        layoutcache{kDefaultLayoutCacheCapacity};
+    // Scratch buffers that keep their capacity between calls.
+    std::vector<uint8_t> fillmask;
+    std::vector<uint8_t> outlinemask;
+    std::vector<uint8_t> pixels;  // BGRA staging for other pixel formats
+    std::vector<DWRITE_LINE_METRICS> linemetrics;
+    std::vector<float> pens;  // glyph origins of a run in placeGlyphs
+    // glyph advances and metrics of renderGlyphRun
+    std::vector<FLOAT> advances;
+    std::vector<DWRITE_GLYPH_METRICS> glyphmetrics;
+  };
+
+  // Tightly packed out_width x out_height surface over |buffer|. Returns
+  // false if it does not fit |buffer_size|.
+  static bool bufferSurface(uint8_t* buffer, int buffer_size, Layout& layout,
+      const RenderParams& renderparams, Surface& surface) {
+    const int bpp = BytesPerPixel(renderparams.pixel_format);
+    layout.out_buffer_size = layout.out_width * layout.out_height * bpp;
+    if (layout.out_buffer_size > buffer_size) {
+      return false;
+    }
+    surface.data = buffer;
+    surface.stride = layout.out_width * bpp;
+    surface.width = layout.out_width;
+    surface.height = layout.out_height;
+    return true;
+  }
+
+  // Draws the glyph runs |drawfunc| feeds the context TextRenderer at (x, y)
+  // of |target|, clipped to it. |drawfunc| is called with the renderer and
+  // the sink to pass as the client drawing context. The cached coverage of
+  // every glyph is summed into out_width x out_height masks, which are then
+  // composited as the software backend does. With |applyoffset| runs move
+  // down by the vertical offset of their font.
+  template <class DrawFunc>
+  void draw(Context& ctx, float dpi, const Surface& target, int x, int y,
+      const Layout& layout, const RenderParams& renderparams,
+      bool applyoffset, DrawFunc&& drawfunc) {
+    const int width = layout.out_width;
+    const int height = layout.out_height;
+    const int x0 = std::max(0, x);
+    const int y0 = std::max(0, y);
+    const int x1 = std::min(target.width, x + width);
+    const int y1 = std::min(target.height, y + height);
+    if (x0 >= x1 || y0 >= y1) {
+      return;
+    }
+    const PixelFormat format = renderparams.pixel_format;
+    uint8_t* dst = target.data + (size_t)y0 * target.stride +
+                   (size_t)x0 * BytesPerPixel(format);
+
+    const size_t pixels = (size_t)width * height;
+    const float scale = dpi / 96.0f;
+    const float outline_width = renderparams.outline_width * scale;
+    const bool aliased =
+        renderparams.antialias_mode == AntialiasMode::ALIASED;
+    ctx.fillmask.assign(pixels, 0);
+    ctx.outlinemask.assign(outline_width > 0.0f ? pixels : 0, 0);
+    auto paintrun = [&](FLOAT origin_x, FLOAT origin_y,
+        const DWRITE_GLYPH_RUN& run, const DWRITE_GLYPH_RUN_DESCRIPTION*) {
+      // Also keeps the face, whose address is in the glyph keys, alive.
+      const float vertical_offset = verticalOffset(run.fontFace);
+      const float baseline =
+          origin_y + (applyoffset ? vertical_offset : 0.0f);
+      GlyphKey key;
+      key.face = run.fontFace;
+      key.aliased = aliased;
+      key.size = run.fontEmSize * scale;
+      // Glyph origins as in placeGlyphs(); odd bidi levels advance right to
+      // left.
+      const bool rtl = run.bidiLevel % 2;
+      float pen = origin_x;
+      for (UINT32 i = 0; i < run.glyphCount; ++i) {
+        if (rtl) {
+          pen -= run.glyphAdvances[i];
+        }
+        float gx = pen;
+        float gy = baseline;
+        if (run.glyphOffsets) {
+          const float offset = run.glyphOffsets[i].advanceOffset;
+          gx += rtl ? -offset : offset;
+          gy -= run.glyphOffsets[i].ascenderOffset;
+        }
+        if (!rtl) {
+          pen += run.glyphAdvances[i];
+        }
+        // Snap the origin to a subpixel phase so masks can be reused.
+        const int sx = (int)std::floor(gx * scale * kSubpixelPhases + 0.5f);
+        const int sy = (int)std::floor(gy * scale * kSubpixelPhases + 0.5f);
+        const int ix = (int)std::floor((float)sx / kSubpixelPhases);
+        const int iy = (int)std::floor((float)sy / kSubpixelPhases);
+        key.glyph = run.glyphIndices[i];
+        key.phase_x = (uint8_t)(sx - ix * kSubpixelPhases);
+        key.phase_y = (uint8_t)(sy - iy * kSubpixelPhases);
+        if (outline_width > 0.0f) {
+          key.outline_width = outline_width;
+          const GlyphMask* mask = glyphMask(ctx, key);
+          add_mask(*mask, ix, iy, ctx.outlinemask.data(), width, height);
+          key.outline_width = 0.0f;
+        }
+        const GlyphMask* mask = glyphMask(ctx, key);
+        add_mask(*mask, ix, iy, ctx.fillmask.data(), width, height);
+      }
+    };
+    GlyphRunSink sink = make_glyph_run_sink(paintrun);
+    ctx.textrenderer->SetPixelsPerDip(scale);
+    drawfunc((IDWriteTextRenderer*)ctx.textrenderer.Get(), &sink);
+
+    const size_t mask_offset = (size_t)(y0 - y) * width + (x0 - x);
+    const uint8_t* fill = ctx.fillmask.data() + mask_offset;
+    const uint8_t* outline =
+        outline_width > 0.0f ? ctx.outlinemask.data() + mask_offset : nullptr;
+    if (format == PixelFormat::A8) {
+      alpha_mask(dst, target.stride, fill, outline, width, x1 - x0, y1 - y0,
+          renderparams);
+      return;
+    }
+
+    // Other formats are composited as BGRA in scratch and converted.
+    uint8_t* bgra = dst;
+    int bgra_stride = target.stride;
+    if (format != PixelFormat::BGRA_PREMULTIPLIED) {
+      bgra_stride = (x1 - x0) * 4;
+      ctx.pixels.resize((size_t)bgra_stride * (y1 - y0));
+      bgra = ctx.pixels.data();
+    }
+    fill_rect(bgra, bgra_stride, x1 - x0, y1 - y0,
+        renderparams.background_color);
+    if (outline) {
+      composite_mask(bgra, bgra_stride, outline, width, x1 - x0, y1 - y0,
+          renderparams.outline_color);
+    }
+    composite_mask(bgra, bgra_stride, fill, width, x1 - x0, y1 - y0,
+        renderparams.foreground_color);
+    if (bgra != dst) {
+      for (int row = 0; row < y1 - y0; ++row) {
+        convert_bgra_row(bgra + (size_t)row * bgra_stride,
+            dst + (size_t)row * target.stride, x1 - x0, format);
+      }
+    }
+  }
+
+  // Cached fill (or outline, when key.outline_width is set) coverage of a
+  // glyph at key.size pixels per em. Fill coverage comes from a DirectWrite
+  // glyph run analysis; the outline is the glyph path stroked and
+  // rasterized as the software backend does.
+  const GlyphMask* glyphMask(Context& ctx, const GlyphKey& key) {
+    if (const GlyphMask* mask = ctx.glyphcache.find(key)) {
+      return mask;
+    }
+    IDWriteFontFace* fontface = (IDWriteFontFace*)key.face;
+    const float origin_x = (float)key.phase_x / kSubpixelPhases;
+    const float origin_y = (float)key.phase_y / kSubpixelPhases;
+    GlyphMask& mask = ctx.mask;
+    if (key.outline_width > 0.0f) {
+      ctx.path.reset(1.0f, origin_x, origin_y);
+      CHECK(fontface->GetGlyphRunOutline(key.size, &key.glyph, NULL, NULL, 1,
+          FALSE, FALSE, ctx.pathsink.Get()));
+      stroke_path(ctx.path, key.outline_width, ctx.stroke);
+      rasterize_path(ctx.stroke, key.aliased, ctx.rasterizer, mask);
+    } else {
+      DWRITE_GLYPH_RUN run{};
+      run.fontFace = fontface;
+      run.fontEmSize = key.size;
+      run.glyphCount = 1;
+      run.glyphIndices = &key.glyph;
+      ComPtr<IDWriteGlyphRunAnalysis> analysis;
+      CHECK(dwritefactory->CreateGlyphRunAnalysis(&run, NULL,
+          key.aliased ? DWRITE_RENDERING_MODE1_ALIASED
+                      : DWRITE_RENDERING_MODE1_NATURAL_SYMMETRIC,
+          DWRITE_MEASURING_MODE_NATURAL, DWRITE_GRID_FIT_MODE_DISABLED,
+          DWRITE_TEXT_ANTIALIAS_MODE_GRAYSCALE, origin_x, origin_y,
+          &analysis));
+      // Aliased analyses only fill the 1x1 texture, the others only the
+      // 3x1 one, whose three bytes are equal in grayscale.
+      const DWRITE_TEXTURE_TYPE texturetype = key.aliased
+                                                  ? DWRITE_TEXTURE_ALIASED_1x1
+                                                  : DWRITE_TEXTURE_CLEARTYPE_3x1;
+      const size_t bpp = key.aliased ? 1 : 3;
+      RECT rect{};
+      CHECK(analysis->GetAlphaTextureBounds(texturetype, &rect));
+      mask.left = rect.left;
+      mask.top = rect.top;
+      mask.width = std::max(0, (int)(rect.right - rect.left));
+      mask.height = std::max(0, (int)(rect.bottom - rect.top));
+      const size_t pixels = (size_t)mask.width * mask.height;
+      mask.coverage.resize(pixels * bpp);
+      if (pixels) {
+        CHECK(analysis->CreateAlphaTexture(texturetype, &rect,
+            mask.coverage.data(), (UINT32)mask.coverage.size()));
+      }
+      // Compact 3x1 texels in place; each source is at or past its target.
+      if (bpp > 1) {
+        for (size_t i = 0; i < pixels; ++i) {
+          mask.coverage[i] = mask.coverage[i * bpp + 1];
+        }
+      }
+      mask.coverage.resize(pixels);
+    }
+    const GlyphMask* cached = ctx.glyphcache.insert(key, mask);
+    return cached ? cached : &mask;
+  }
+
+  float verticalOffset(IDWriteFontFace* ff) {
+    {
+      std::shared_lock<std::shared_mutex> lock(faceoffsetsmutex);
+      auto it = faceoffsets.find(ff);
+      if (it != faceoffsets.end()) {
+        return it->second.vertical_offset;
+      }
+    }
+    std::unique_lock<std::shared_mutex> lock(faceoffsetsmutex);
+    return resolveVerticalOffset(ff);
+  }
+
+  // Slow path for faces not seen at Init (e.g. system fallback fonts): match
+  // by family name once, then remember the face. faceoffsetsmutex is held.
+  float resolveVerticalOffset(IDWriteFontFace* ff) {
+    ComPtr<IDWriteFontFace5> ff5;
+    CHECK(ff->QueryInterface<IDWriteFontFace5>(&ff5));
+    ComPtr<IDWriteLocalizedStrings> names;
+    CHECK(ff5->GetFamilyNames(&names));
+    thread_local wchar_t buf[1024];
+    CHECK(names->GetString(0, buf, 1024));
+    auto it = fontfamilymap.find(buf);
+    const float offset =
+        it != fontfamilymap.end() ? it->second->vertical_offset : 0.0f;
+    faceoffsets[ff] = {ff, offset};
+    return offset;
+  }
+
+  bool calcSize(Context& ctx, const ComPtr<IDWriteTextLayout>& textlayout,
+      Layout& layout) {
+    DWRITE_TEXT_METRICS text_metrics{};
+    CHECK(textlayout->GetMetrics(&text_metrics));
+    const size_t required_size = (int)(text_metrics.width + 0.5f) * 4 *
+                                 (int)(text_metrics.height + 0.5f);
+    layout.out_buffer_size = (int)required_size;
+
+    DWRITE_OVERHANG_METRICS overhang_metrics{};
+    CHECK(textlayout->GetOverhangMetrics(&overhang_metrics));
+    layout.out_width = (int)(text_metrics.width + 0.5f);
+    layout.out_height = (int)(text_metrics.height + 0.5f);
+    layout.out_padding_top = (int)(-std::min(0.0f, overhang_metrics.top));
+    layout.out_padding_left = (int)(-std::min(0.0f, overhang_metrics.left));
+    layout.out_padding_right = layout.out_width - (int)(layout.max_width + overhang_metrics.right);
+    layout.out_padding_bottom = layout.out_height - (int)(layout.max_height + overhang_metrics.bottom);
+
+    std::vector<DWRITE_LINE_METRICS>& line_metrics = ctx.linemetrics;
+    line_metrics.resize(text_metrics.lineCount);
+    UINT32 line_count = 0;
+    CHECK(textlayout->GetLineMetrics(
+        line_metrics.data(), (UINT32)line_metrics.size(), &line_count));
+
+    if (!line_metrics.empty()) {
+      layout.out_baseline =
+          (int)(line_metrics.front().baseline - overhang_metrics.top + 0.5f);
+    }
+
+    return true;
+  }
+
+  ComPtr<IDWriteTextFormat> createTextFormat(Context& ctx, const Layout& layout, const FontSet& fs, float dpi) {
+    const TextFormatKey key(layout);
+    auto it = ctx.textformats.find(key);
+    if (it != ctx.textformats.end()) {
+      return it->second;
+    }
+
+    ComPtr<IDWriteTextFormat> textformat;
+    const float dip = layout.font_size / (dpi / 96.0f);
+    CHECK(dwritefactory->CreateTextFormat(firstfamilyname.c_str(),
+        fontcollection.Get(), (DWRITE_FONT_WEIGHT)layout.font_weight,
+        (DWRITE_FONT_STYLE)layout.font_style,
+        (DWRITE_FONT_STRETCH)layout.font_stretch, dip,
+        utf8_to_utf16(fs.locale).c_str(), &textformat));
+    if (fallback) {
+      ComPtr<IDWriteTextFormat3> textformat3;
+      textformat.As(&textformat3);
+      CHECK(textformat3->SetFontFallback(fallback.Get()));
+    }
+    ctx.textformats.emplace(key, textformat);
+    return textformat;
+  }
+
+  ComPtr<IDWriteTextLayout> cachedTextLayout(Context& ctx,
+      const Layout& layout, const FontSet& fs, float dpi,
+      std::u16string_view text) {
+    if (ComPtr<IDWriteTextLayout>* cached =
+            ctx.layoutcache.find(LayoutKeyRef{text, &layout})) {
+      return *cached;
+    }
+    ComPtr<IDWriteTextFormat> textformat =
+        createTextFormat(ctx, layout, fs, dpi);
+    ComPtr<IDWriteTextLayout> textlayout =
+        createTextLayout(textformat, layout, text);
+    ComPtr<IDWriteTextLayout> entry = textlayout;
+    ctx.layoutcache.insert(LayoutKeyRef{text, &layout}, entry);
+    return textlayout;
+  }
+
+  ComPtr<IDWriteTextLayout> createTextLayout(ComPtr<IDWriteTextFormat> textformat,
+      const Layout& layout, std::u16string_view text) {
+    ComPtr<IDWriteTextLayout> textlayout;
+    CHECK(dwritefactory->CreateTextLayout((const WCHAR*)text.data(),
+        (UINT32)text.length(), textformat.Get(), (FLOAT)layout.max_width,
+        (FLOAT)layout.max_height, &textlayout));
+    textlayout->SetWordWrapping((DWRITE_WORD_WRAPPING)layout.word_wrap_mode);
+    return textlayout;
+  }
+
+  ComPtr<IDWriteFactory7> dwritefactory;
+  ComPtr<IDWriteFontSet> fontset;
+  ComPtr<IDWriteFontCollection1> fontcollection;
+  ComPtr<IDWriteFontFallback> fallback;
+  std::unordered_map<std::wstring, Font*> fontfamilymap;
+  // Vertical offset by face identity; the ComPtr keeps the key alive.
+  // Fallback faces are added while drawing, hence the lock.
+  struct FaceOffset {
+    ComPtr<IDWriteFontFace> fontface;
+    float vertical_offset = 0.0f;
+  };
+  std::unordered_map<IDWriteFontFace*, FaceOffset> faceoffsets;
+  std::shared_mutex faceoffsetsmutex;
+  std::vector<const Font*> familyfonts;  // per fontcollection family
+  std::wstring firstfamilyname;
+  // One per call in flight.
+  mutable ContextPool<Context> contexts{[this] {
+    auto context = std::make_unique<Context>();
+    context->textrenderer = Make<TextRenderer>();
+    context->pathsink = Make<PathGeometrySink>(&context->path);
+    context->glyphcache.setBudget(glyphcachebudget);
+    context->layoutcache.setCapacity(layoutcachecapacity);
+    return context;
+  }};
+  size_t glyphcachebudget = kDefaultGlyphCacheBudget;
+  size_t layoutcachecapacity = kDefaultLayoutCacheCapacity;
+};
+
+std::unique_ptr<SimpleDWriteImpl> CreateDWriteImpl() {
+  return std::make_unique<DWriteImpl>();
+}
+#endif  // _WIN32
+
+Font::Font(const std::string& name, float vertical_offset)
+    : name(name), data(), data_size(), vertical_offset(vertical_offset) {}
+
+Font::Font(const void* data, size_t data_size, float vertical_offset)
+    : name(),
+      data(data),
+      data_size(data_size),
+      vertical_offset(vertical_offset) {}
+
+FallbackFont::FallbackFont(const std::string& family,
+    const std::vector<std::pair<uint32_t, uint32_t>>& ranges)
+    : ranges(ranges), family(family) {}
+
+FontSet FontSet::Default() {
+  static FontSet fontset;
+  static std::once_flag once;
+  std::call_once(once, [&] {
+#ifdef _WIN32
+    wchar_t locale[LOCALE_NAME_MAX_LENGTH];
+    int ret = ::GetUserDefaultLocaleName(locale, LOCALE_NAME_MAX_LENGTH);
+    fontset.locale = utf16_to_utf8(locale);
+#else
+    // "ja_JP.UTF-8" -> "ja-JP"
+    for (const char* env : {"LC_ALL", "LC_MESSAGES", "LANG"}) {
+      const char* value = std::getenv(env);
+      if (value == nullptr || *value == '\0') {
+        continue;
+      }
+      std::string locale(value);
+      locale = locale.substr(0, locale.find_first_of(".@"));
+      if (locale == "C" || locale == "POSIX") {
+        break;
+      }
+      std::replace(locale.begin(), locale.end(), '_', '-');
+      fontset.locale = locale;
+      break;
+    }
+    if (fontset.locale.empty()) {
+      fontset.locale = "en-US";
+    }
+#endif
+  });
+  return fontset;
+}
+
+FontSet::FontSet() {}
+
+static float system_dpi() {
+#ifdef _WIN32
+  return (float)::GetDpiForSystem();
+#else
+  return 96.0f;
+#endif
+}
+
+static Backend resolve_backend([[maybe_unused]] Backend backend) {
+#ifdef _WIN32
+  if (backend == Backend::DEFAULT) {
+    return Backend::DIRECTWRITE;
+  }
+  return backend;
+#else
+  return Backend::SOFTWARE;
+#endif
+}
+
+static std::unique_ptr<SimpleDWriteImpl> create_impl(
+    [[maybe_unused]] Backend backend) {
+#ifdef _WIN32
+  if (backend == Backend::DIRECTWRITE) {
+    return CreateDWriteImpl();
+  }
+#endif
+  return CreateSoftImpl();
+}
+
+// UTF-16 copy of |text| in a per-thread buffer that keeps its capacity, so
+// steady calls do not allocate. Valid until the next call on this thread.
+static std::u16string_view scratch_u16(std::string_view text) {
+  thread_local std::u16string buffer;
+  utf8_to_u16(text, buffer);
+  return buffer;
+}
+
+static std::u16string_view scratch_u16(std::u32string_view text) {
+  thread_local std::u16string buffer;
+  u32_to_u16(text, buffer);
+  return buffer;
+}
+
+static Status status_of(const std::exception& ex) {
+  if (const Error* error = dynamic_cast<const Error*>(&ex)) {
+    return error->status();
+  }
+  if (dynamic_cast<const std::bad_alloc*>(&ex)) {
+    return Status::OUT_OF_MEMORY;
+  }
+  return Status::UNKNOWN;
+}
+
+static const char kBufferTooSmall[] = "not enough buffer size.";
+
+SimpleDWrite::SimpleDWrite() : SimpleDWrite(Backend::DEFAULT) {}
+
+SimpleDWrite::SimpleDWrite(Backend backend)
+    : dpi_(system_dpi()),
+      backend_(resolve_backend(backend)),
+      impl(create_impl(backend_)) {}
+
+SimpleDWrite::~SimpleDWrite() {}
+
+bool SimpleDWrite::Init(const FontSet& fs, float dpi) {
+  fs_ = fs;
+  dpi_ = dpi;
+
+  try {
+    return impl->init(fs_, dpi_);
+  } catch (std::exception& ex) {
+    setLastError(ex);
+    return false;
+  }
+  return false;
+}
+
+bool SimpleDWrite::CalcSize(std::string_view text, Layout& layout) const {
+  return CalcSize(scratch_u16(text), layout);
+}
+
+bool SimpleDWrite::CalcSize(std::u16string_view text, Layout& layout) const {
+  try {
+    return impl->calcSize(fs_, dpi_, text, layout);
+  } catch (std::exception& ex) {
+    setLastError(ex);
+    return false;
+  }
+}
+
+bool SimpleDWrite::CalcSize(std::u32string_view text, Layout& layout) const {
+  return CalcSize(scratch_u16(text), layout);
+}
+
+bool SimpleDWrite::Render(std::string_view text, uint8_t* buffer,
+    int buffer_size, Layout& layout, const RenderParams& renderparams) const {
+  return Render(scratch_u16(text), buffer, buffer_size, layout, renderparams);
+}
+
+bool SimpleDWrite::Render(std::u16string_view text, uint8_t* buffer,
+    int buffer_size, Layout& layout, const RenderParams& renderparams) const {
+  try {
+    if (impl->render(
+            fs_, dpi_, text, buffer, buffer_size, layout, renderparams)) {
+      return true;
+    }
+    setLastError(Status::BUFFER_TOO_SMALL, kBufferTooSmall);
+    return false;
+  } catch (std::exception& ex) {
+    setLastError(ex);
+    return false;
+  }
+}
+
+bool SimpleDWrite::Render(std::u32string_view text, uint8_t* buffer,
+    int buffer_size, Layout& layout, const RenderParams& renderparams) const {
+  return Render(scratch_u16(text), buffer, buffer_size, layout, renderparams);
+}
+
+bool SimpleDWrite::RenderInto(std::string_view text, const Surface& surface,
+    int x, int y, Layout& layout, const RenderParams& renderparams) const {
+  return RenderInto(scratch_u16(text), surface, x, y, layout, renderparams);
+}
+
+bool SimpleDWrite::RenderInto(std::u16string_view text,
+    const Surface& surface, int x, int y, Layout& layout,
+    const RenderParams& renderparams) const {
+  try {
+    if (surface.data == nullptr || surface.width < 0 || surface.height < 0 ||
+        surface.stride <
+            surface.width * BytesPerPixel(renderparams.pixel_format)) {
+      throw Error(Status::INVALID_ARGUMENT, "invalid Surface.");
+    }
+    return impl->renderInto(
+        fs_, dpi_, text, surface, x, y, layout, renderparams);
+  } catch (std::exception& ex) {
+    setLastError(ex);
+    return false;
+  }
+}
+
+bool SimpleDWrite::RenderInto(std::u32string_view text,
+    const Surface& surface, int x, int y, Layout& layout,
+    const RenderParams& renderparams) const {
+  return RenderInto(scratch_u16(text), surface, x, y, layout, renderparams);
+}
+
+bool SimpleDWrite::RenderGlyphRun(const GlyphRun& glyphrun, uint8_t* buffer,
+    int buffer_size, Layout& layout, const RenderParams& renderparams) const {
+  try {
+    if (glyphrun.font_index < 0 ||
+        glyphrun.font_index >= (int)fs_.fonts.size()) {
+      throw Error(Status::INVALID_ARGUMENT,
+          "GlyphRun::font_index is out of range.");
+    }
+    if (glyphrun.glyph_count && glyphrun.glyph_indices == nullptr) {
+      throw Error(Status::INVALID_ARGUMENT, "GlyphRun::glyph_indices is null.");
+    }
+    if (impl->renderGlyphRun(fs_, dpi_, glyphrun, buffer, buffer_size,
+            layout, renderparams)) {
+      return true;
+    }
+    setLastError(Status::BUFFER_TOO_SMALL, kBufferTooSmall);
+    return false;
+  } catch (std::exception& ex) {
+    setLastError(ex);
+    return false;
+  }
+}
+
+struct AsyncTask::State {
+  // Stores |result| and wakes whoever waits for it.
+  void finish(AsyncResult&& value) {
+    std::coroutine_handle<> continuation;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      result = std::move(value);
+      done = true;
+      continuation = std::exchange(this->continuation, nullptr);
+    }
+    finished.notify_all();
+    if (continuation) {
+      continuation.resume();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable finished;
+  bool done = false;
+  AsyncResult result;
+  std::coroutine_handle<> continuation;
+  std::atomic<bool> canceled = false;
+};
+
+static const AsyncResult& invalid_result() {
+  static const AsyncResult result = [] {
+    AsyncResult r;
+    r.status = Status::INVALID_ARGUMENT;
+    r.error = "invalid AsyncTask.";
+    return r;
+  }();
+  return result;
+}
+
+bool AsyncTask::ready() const {
+  if (!state_) {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->done;
+}
+
+void AsyncTask::wait() const {
+  if (!state_) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(state_->mutex);
+  state_->finished.wait(lock, [this] { return state_->done; });
+}
+
+const AsyncResult& AsyncTask::get() const {
+  if (!state_) {
+    return invalid_result();
+  }
+  wait();
+  return state_->result;
+}
+
+void AsyncTask::cancel() {
+  if (state_) {
+    state_->canceled = true;
+  }
+}
+
+bool AsyncTask::await_suspend(std::coroutine_handle<> handle) {
+  if (!state_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  if (state_->done) {
+    return false;
+  }
+  state_->continuation = handle;
+  return true;
+}
+
+AsyncResult AsyncTask::await_resume() {
+  if (!state_) {
+    return invalid_result();
+  }
+  return std::move(state_->result);
+}
+
+AsyncTask SimpleDWrite::CalcSizeAsync(
+    const std::string& text, const Layout& layout) const {
+  AsyncTask task;
+  task.state_ = std::make_shared<AsyncTask::State>();
+  asyncPool().submit([this, state = task.state_, text, layout] {
+    AsyncResult result;
+    result.layout = layout;
+    if (state->canceled) {
+      result.canceled = true;
+    } else {
+      try {
+        result.ok =
+            impl->calcSize(fs_, dpi_, scratch_u16(text), result.layout);
+      } catch (std::exception& ex) {
+        result.status = status_of(ex);
+        result.error = ex.what();
+      }
+    }
+    state->finish(std::move(result));
+  });
+  return task;
+}
+
+AsyncTask SimpleDWrite::RenderAsync(const std::string& text,
+    const Layout& layout, const RenderParams& renderparams) const {
+  AsyncTask task;
+  task.state_ = std::make_shared<AsyncTask::State>();
+  asyncPool().submit([this, state = task.state_, text, layout, renderparams] {
+    AsyncResult result;
+    result.layout = layout;
+    try {
+      const std::u16string_view u16text = scratch_u16(text);
+      // Measuring sizes the buffer and is the last point to give up.
+      if (!state->canceled &&
+          impl->calcSize(fs_, dpi_, u16text, result.layout) &&
+          !state->canceled) {
+        result.pixels.resize((size_t)result.layout.out_width *
+                             result.layout.out_height *
+                             BytesPerPixel(renderparams.pixel_format));
+        result.ok = impl->render(fs_, dpi_, u16text, result.pixels.data(),
+            (int)result.pixels.size(), result.layout, renderparams);
+      }
+      result.canceled = state->canceled && !result.ok;
+    } catch (std::exception& ex) {
+      result.status = status_of(ex);
+      result.error = ex.what();
+    }
+    state->finish(std::move(result));
+  });
+  return task;
+}
+
+bool SimpleDWrite::CalcSizeBatch(std::span<const std::string> texts,
+    const Layout& layout, BatchMetrics& metrics) const {
+  // Strings measured per task; smaller batches stay on the calling thread.
+  constexpr size_t kChunkSize = 64;
+  const size_t count = texts.size();
+  for (std::vector<int>* array : {&metrics.width, &metrics.height,
+           &metrics.padding_top, &metrics.padding_left,
+           &metrics.padding_right, &metrics.padding_bottom,
+           &metrics.baseline}) {
+    array->assign(count, 0);
+  }
+  metrics.ok.assign(count, 0);
+  try {
+    const size_t chunks = (count + kChunkSize - 1) / kChunkSize;
+    if (chunks <= 1) {
+      impl->calcSizes(fs_, dpi_, texts, 0, count, layout, metrics);
+    } else {
+      pool().parallelFor(chunks, [&](size_t chunk) {
+        impl->calcSizes(fs_, dpi_, texts, chunk * kChunkSize,
+            std::min(count, (chunk + 1) * kChunkSize), layout, metrics);
+      });
+    }
+    return true;
+  } catch (std::exception& ex) {
+    setLastError(ex);
+    return false;
+  }
+}
+
+bool SimpleDWrite::RenderBatch(
+    std::span<BatchItem> items, std::vector<uint8_t>& buffer) const {
+  std::mutex error_mutex;
+  Status status = Status::OK;
+  std::string error;
+  auto fail = [&](BatchItem& item, const std::exception& ex) {
+    item.ok = false;
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if (status == Status::OK) {
+      status = status_of(ex);
+      error = ex.what();
+    }
+  };
+
+  // Measure first so that the whole output is one allocation.
+  pool().parallelFor(items.size(), [&](size_t i) {
+    BatchItem& item = items[i];
+    try {
+      item.ok = impl->calcSize(fs_, dpi_, scratch_u16(item.text), item.layout);
+    } catch (std::exception& ex) {
+      fail(item, ex);
+    }
+  });
+  size_t size = 0;
+  for (BatchItem& item : items) {
+    item.offset = size;
+    if (item.ok) {
+      const size_t bytes = (size_t)item.layout.out_width *
+                           item.layout.out_height *
+                           BytesPerPixel(item.renderparams.pixel_format);
+      size = (size + bytes + 15) & ~(size_t)15;
+    }
+  }
+  buffer.resize(size);
+
+  pool().parallelFor(items.size(), [&](size_t i) {
+    BatchItem& item = items[i];
+    if (!item.ok) {
+      return;
+    }
+    const size_t end = i + 1 < items.size() ? items[i + 1].offset : size;
+    try {
+      item.ok = impl->render(fs_, dpi_, scratch_u16(item.text),
+          buffer.data() + item.offset, (int)(end - item.offset), item.layout,
+          item.renderparams);
+    } catch (std::exception& ex) {
+      fail(item, ex);
+    }
+  });
+  if (status != Status::OK) {
+    setLastError(status, error.c_str());
+    return false;
+  }
+  return std::all_of(items.begin(), items.end(),
+      [](const BatchItem& item) { return item.ok; });
+}
+
+bool SimpleDWrite::BuildAtlas(const AtlasParams& params, Atlas& atlas) const {
+  try {
+    build_atlas(*impl, fs_, dpi_, params, atlas);
+    return true;
+  } catch (std::exception& ex) {
+    setLastError(ex);
+    return false;
+  }
+}
+
+bool SimpleDWrite::UpdateAtlas(
+    const std::string& text, DynamicAtlas& atlas) const {
+  try {
+    atlas.impl->update(*impl, fs_, dpi_, scratch_u16(text));
+    return true;
+  } catch (std::exception& ex) {
+    setLastError(ex);
+    return false;
+  }
+}
+
+bool SimpleDWrite::RenderToQuads(const std::string& text, const Atlas& atlas,
+    float x, float y, Layout& layout, std::vector<GlyphQuad>& quads,
+    const RenderParams& renderparams) const {
+  try {
+    if (atlas.font_size <= 0) {
+      throw Error(Status::INVALID_ARGUMENT, "Atlas::font_size is not set.");
+    }
+    std::vector<PlacedGlyph> placed;
+    if (!impl->placeGlyphs(fs_, dpi_, scratch_u16(text), layout, placed)) {
+      return false;
+    }
+    append_quads(placed,
+        [&atlas](uint32_t codepoint) { return atlas.Find(codepoint); },
+        (float)layout.font_size / atlas.font_size, x, y,
+        renderparams.foreground_color, quads);
+    return true;
+  } catch (std::exception& ex) {
+    setLastError(ex);
+    return false;
+  }
+}
+
+bool SimpleDWrite::RenderToQuads(const std::string& text, DynamicAtlas& atlas,
+    float x, float y, Layout& layout, std::vector<GlyphQuad>& quads,
+    const RenderParams& renderparams) const {
+  try {
+    const std::u16string_view u16text = scratch_u16(text);
+    std::vector<PlacedGlyph> placed;
+    if (!impl->placeGlyphs(fs_, dpi_, u16text, layout, placed)) {
+      return false;
+    }
+    // Adding glyphs may repack the pages, so look them up afterwards.
+    atlas.impl->update(*impl, fs_, dpi_, u16text);
+    const int font_size = atlas.impl->params().layout.font_size;
+    append_quads(placed,
+        [&atlas](uint32_t codepoint) { return atlas.impl->find(codepoint); },
+        (float)layout.font_size / std::max(1, font_size), x, y,
+        renderparams.foreground_color, quads);
+    return true;
+  } catch (std::exception& ex) {
+    setLastError(ex);
+    return false;
+  }
+}
+
+float SimpleDWrite::SdfOutlineThreshold(const AtlasParams& params) const {
+  if (!(params.sdf_range > 0.0f)) {
+    return 0.5f;
+  }
+  // The outline is centered on the edge, so half of it lies outside.
+  const float width = params.renderparams.outline_width * dpi_ / 96.0f;
+  return std::clamp(0.5f - width / (4.0f * params.sdf_range), 0.0f, 1.0f);
+}
+
+std::string SimpleDWrite::GetLastError() const {
+  std::lock_guard<std::mutex> lock(last_error_mutex_);
+  return last_error_;
+}
+
+Status SimpleDWrite::GetLastStatus() const {
+  std::lock_guard<std::mutex> lock(last_error_mutex_);
+  return last_status_;
+}
+
+ThreadPool& SimpleDWrite::pool() const {
+  std::call_once(pool_once_, [this] {
+    // The calling thread works too.
+    const unsigned threads = std::thread::hardware_concurrency();
+    pool_ = std::make_unique<ThreadPool>(threads > 1 ? threads - 1 : 1);
+  });
+  return *pool_;
+}
+
+ThreadPool& SimpleDWrite::asyncPool() const {
+  std::call_once(async_pool_once_, [this] {
+    const unsigned threads = std::thread::hardware_concurrency();
+    async_pool_ = std::make_unique<ThreadPool>(threads > 1 ? threads : 1);
+  });
+  return *async_pool_;
+}
+
+void SimpleDWrite::setLastError(Status status, const char* message) const {
+  std::lock_guard<std::mutex> lock(last_error_mutex_);
+  last_status_ = status;
+  last_error_ = message;  // reuses the capacity of the previous message
+}
+
+void SimpleDWrite::setLastError(const std::exception& ex) const {
+  setLastError(status_of(ex), ex.what());
+}
+
+Backend SimpleDWrite::GetBackend() const { return backend_; }
+
+std::vector<FontStats> SimpleDWrite::GetFontStats() const {
+  return impl->fontStats();
+}
+
+void SimpleDWrite::SetGlyphCacheBudget(size_t bytes) {
+  impl->setGlyphCacheBudget(bytes);
+}
+
+GlyphCacheStats SimpleDWrite::GetGlyphCacheStats() const {
+  return impl->glyphCacheStats();
+}
+
+void SimpleDWrite::SetLayoutCacheCapacity(size_t entries) {
+  impl->setLayoutCacheCapacity(entries);
+}
+
+LayoutCacheStats SimpleDWrite::GetLayoutCacheStats() const {
+  return impl->layoutCacheStats();
 }
 
-std::string SimpleDWrite::GetLastError() const { return std::string(); }
+void SimpleDWrite::Trim() { impl->trim(); }
 
 }  // namespace simpledwrite
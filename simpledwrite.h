@@ -3,8 +3,15 @@
 // simpledwrite
 // https://github.com/fecf/simpledwrite
 
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace simpledwrite {
@@ -60,6 +67,60 @@ enum class TextAntialiasMode {
   GRAYSCALE = 2,
   ALIASED = 3,
 };
+// Render output pixel layout.
+//   BGRA_PREMULTIPLIED : 32bpp, background composited (default)
+//   A8                 : 8bpp alpha of the text alone, background ignored
+//   RGBA_STRAIGHT      : 32bpp, non-premultiplied
+//   RGB565             : 16bpp little endian, alpha dropped
+enum class PixelFormat {
+  BGRA_PREMULTIPLIED = 0,
+  A8 = 1,
+  RGBA_STRAIGHT = 2,
+  RGB565 = 3,
+};
+int BytesPerPixel(PixelFormat format);
+
+// Pixel conversion kernels behind the output formats, vectorized with
+// SSE2/AVX2 where the CPU supports it. Each converts |count| 4-byte pixels;
+// |src| and |dst| may be the same buffer.
+//   PremultipliedToStraight / StraightToPremultiplied : alpha in byte 3
+//   SwapRedBlue  : BGRA <-> RGBA
+//   ExtractAlpha : BGRA -> A8 (|dst| holds |count| bytes)
+void PremultipliedToStraight(const uint8_t* src, uint8_t* dst, size_t count);
+void StraightToPremultiplied(const uint8_t* src, uint8_t* dst, size_t count);
+void SwapRedBlue(const uint8_t* src, uint8_t* dst, size_t count);
+void ExtractAlpha(const uint8_t* src, uint8_t* dst, size_t count);
+
+// Why the last failed call failed; see SimpleDWrite::GetLastStatus().
+//   INVALID_ARGUMENT : bad Surface, GlyphRun, Font or atlas parameters
+//   BUFFER_TOO_SMALL : Render output does not fit buffer_size; the needed
+//                      size is in Layout::out_buffer_size. Not an exception
+//                      internally, so probing for the size is cheap.
+//   FONT_NOT_FOUND   : a Font or GlyphRun::font_index did not load
+//   ATLAS_FULL       : glyphs do not fit the atlas
+//   SYSTEM_ERROR     : a DirectWrite call failed
+//   OUT_OF_MEMORY    : an allocation failed
+//   UNKNOWN          : anything else
+enum class Status {
+  OK = 0,
+  INVALID_ARGUMENT = 1,
+  BUFFER_TOO_SMALL = 2,
+  FONT_NOT_FOUND = 3,
+  ATLAS_FULL = 4,
+  SYSTEM_ERROR = 5,
+  OUT_OF_MEMORY = 6,
+  UNKNOWN = 7,
+};
+
+// Rendering engine behind SimpleDWrite.
+//   DEFAULT     : DIRECTWRITE on Windows, SOFTWARE elsewhere
+//   DIRECTWRITE : DirectWrite (Windows only, falls back to SOFTWARE)
+//   SOFTWARE    : self-contained sfnt parser and rasterizer, no OS dependency
+enum class Backend {
+  DEFAULT = 0,
+  DIRECTWRITE = 1,
+  SOFTWARE = 2,
+};
 
 struct Font {
   Font() = default;
@@ -110,7 +171,7 @@ struct Layout {
   int out_padding_left = 0;
   int out_padding_right = 0;
   int out_padding_bottom = 0;
-  int out_buffer_size = 0;
+  int out_buffer_size = 0;  // CalcSize: 32bpp, Render: pixel_format
   int out_baseline = 0;  // baseline height of first line
 };
 
@@ -128,26 +189,359 @@ struct RenderParams {
   Color outline_color = {1, 1, 1, 1};
   AntialiasMode antialias_mode = AntialiasMode::PER_PRIMITIVE;
   TextAntialiasMode text_antialias_mode = TextAntialiasMode::DEFAULT;
+  PixelFormat pixel_format = PixelFormat::BGRA_PREMULTIPLIED;
+};
+
+// Caller-owned image in RenderParams::pixel_format, rows |stride| bytes
+// apart.
+struct Surface {
+  uint8_t* data = nullptr;
+  int stride = 0;
+  int width = 0;
+  int height = 0;
+};
+
+// Same as DWRITE_GLYPH_OFFSET, in DIPs.
+struct GlyphOffset {
+  float advance_offset = 0.0f;
+  float ascender_offset = 0.0f;
+};
+
+// Pre-shaped glyphs of one font, same as DWRITE_GLYPH_RUN.
+struct GlyphRun {
+  int font_index = 0;  // index into FontSet::fonts
+  const uint16_t* glyph_indices = nullptr;
+  const float* glyph_advances = nullptr;       // DIPs, nullptr = font advances
+  const GlyphOffset* glyph_offsets = nullptr;  // nullptr = no offsets
+  uint32_t glyph_count = 0;
+};
+
+// Per-face statistics of the fonts loaded by Init (SOFTWARE backend).
+struct FontStats {
+  std::string family;
+  int weight = 400;
+  bool italic = false;
+  int glyph_count = 0;
+  size_t cmap_bytes = 0;  // codepoint -> glyph lookup tables
+};
+
+// Glyph coverage cache; fill and outline coverage are separate entries.
+struct GlyphCacheStats {
+  size_t entries = 0;
+  size_t bytes = 0;
+  size_t budget = 0;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+};
+
+// Cache of laid out text shared by CalcSize and Render.
+struct LayoutCacheStats {
+  size_t entries = 0;
+  size_t capacity = 0;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
+// What atlas pages hold.
+//   COVERAGE : rendered glyphs in renderparams.pixel_format
+//   SDF      : A8 signed distance field, 0.5 on the outline, higher inside
+//   MSDF     : BGRA multi-channel field; the median of B, G, R is the
+//              distance with sharp corners, A the true distance
+// Fields scale to any size; renderparams.outline_width becomes a threshold
+// (SdfOutlineThreshold) instead of a stroke.
+enum class AtlasMode {
+  COVERAGE = 0,
+  SDF = 1,
+  MSDF = 2,
 };
 
+// Input of SimpleDWrite::BuildAtlas.
+struct AtlasParams {
+  AtlasParams() { renderparams.pixel_format = PixelFormat::A8; }
+
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;  // codepoints, inclusive
+  Layout layout;  // font_size, font_weight, font_style, font_stretch
+  RenderParams renderparams;  // pixel_format: A8 or BGRA_PREMULTIPLIED
+  int page_width = 1024;
+  int page_height = 1024;
+  int padding = 1;  // empty texels around each glyph
+  AtlasMode mode = AtlasMode::COVERAGE;
+  float sdf_range = 4.0f;  // pixels of distance encoded each side
+};
+
+// One packed glyph, pixels unless noted. A quad for a pen position (x, y)
+// on the baseline spans (x + bearing_x, y - bearing_y + vertical_offset)
+// to that plus (width, height).
+struct AtlasGlyph {
+  uint32_t codepoint = 0;
+  int page = -1;  // -1 for glyphs without ink (spaces)
+  int x = 0;      // top-left in the page
+  int y = 0;
+  int width = 0;
+  int height = 0;
+  float u0 = 0.0f;  // texture coordinates, 0..1
+  float v0 = 0.0f;
+  float u1 = 0.0f;
+  float v1 = 0.0f;
+  float advance = 0.0f;
+  float bearing_x = 0.0f;  // pen to left edge
+  float bearing_y = 0.0f;  // baseline to top edge, up positive
+  float vertical_offset = 0.0f;  // Font::vertical_offset of the face, scaled
+};
+
+struct AtlasPage {
+  int width = 0;
+  int height = 0;
+  PixelFormat pixel_format = PixelFormat::A8;
+  std::vector<uint8_t> pixels;  // rows of width * BytesPerPixel bytes
+};
+
+struct Atlas {
+  // nullptr if |codepoint| was not requested or no font has it.
+  const AtlasGlyph* Find(uint32_t codepoint) const;
+
+  std::vector<AtlasPage> pages;
+  std::vector<AtlasGlyph> glyphs;  // sorted by codepoint
+  int font_size = 0;  // AtlasParams::layout.font_size
+};
+
+// Texels of a page written since DynamicAtlas::BeginFrame().
+struct AtlasRect {
+  int page = 0;
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
+
+// Atlas filled on demand by SimpleDWrite::UpdateAtlas, for scripts too
+// large to bake up front. AtlasParams::ranges is ignored. When every page
+// is full, glyphs not used since the last BeginFrame() are evicted, least
+// recently used first, and their space is reused. If that still leaves no
+// room the pages are repacked, which moves glyphs, so read positions after
+// the frame's last UpdateAtlas.
+class DynamicAtlasImpl;
+class DynamicAtlas {
+ public:
+  explicit DynamicAtlas(const AtlasParams& params, int max_pages = 1);
+  ~DynamicAtlas();
+
+  // Starts a frame: clears the dirty rects and unpins the glyphs used so far.
+  void BeginFrame();
+  // nullptr if |codepoint| is not in the atlas. Marks the glyph used; the
+  // pointer is valid until it is evicted.
+  const AtlasGlyph* Find(uint32_t codepoint);
+  const std::vector<AtlasPage>& Pages() const;
+  const std::vector<AtlasRect>& DirtyRects() const;
+  size_t GlyphCount() const;
+  uint64_t Evictions() const;
+
+ private:
+  friend class SimpleDWrite;
+  std::unique_ptr<DynamicAtlasImpl> impl;
+};
+
+// Glyph of SimpleDWrite::RenderToQuads: a textured rect in pixels, y down.
+struct GlyphQuad {
+  int page = 0;  // atlas page
+  float x0 = 0.0f;
+  float y0 = 0.0f;
+  float x1 = 0.0f;
+  float y1 = 0.0f;
+  float u0 = 0.0f;
+  float v0 = 0.0f;
+  float u1 = 0.0f;
+  float v1 = 0.0f;
+  Color color;
+};
+
+// One string of SimpleDWrite::RenderBatch.
+struct BatchItem {
+  std::string text;
+  Layout layout;  // out_* are filled in
+  RenderParams renderparams;
+  // out: offset of the image in the batch buffer; rows are out_width *
+  // BytesPerPixel(renderparams.pixel_format) bytes
+  size_t offset = 0;
+  bool ok = false;  // out
+};
+
+// Layout outputs of SimpleDWrite::CalcSizeBatch as parallel arrays, element
+// i being string i.
+struct BatchMetrics {
+  std::vector<int> width;
+  std::vector<int> height;
+  std::vector<int> padding_top;
+  std::vector<int> padding_left;
+  std::vector<int> padding_right;
+  std::vector<int> padding_bottom;
+  std::vector<int> baseline;
+  std::vector<uint8_t> ok;  // 0 where measuring failed
+};
+
+// Outcome of SimpleDWrite::RenderAsync / CalcSizeAsync.
+struct AsyncResult {
+  bool ok = false;
+  bool canceled = false;
+  Layout layout;                 // with the outputs filled in
+  std::vector<uint8_t> pixels;   // RenderAsync: layout.out_buffer_size bytes
+  Status status = Status::OK;    // why the call failed
+  std::string error;
+};
+
+// Pending RenderAsync / CalcSizeAsync call, run on worker threads of its
+// own, apart from the batch calls. Wait with get(), or co_await it from a
+// coroutine, which then resumes on the worker thread that finished the
+// call. A default constructed or moved-from task is not valid(): it is
+// ready, and its result fails with INVALID_ARGUMENT.
+class AsyncTask {
+ public:
+  AsyncTask() = default;
+
+  bool valid() const { return state_ != nullptr; }
+  bool ready() const;
+  void wait() const;
+  // Waits and returns the result, valid as long as the task.
+  const AsyncResult& get() const;
+  // Skips the work if it has not started, or the rendering if only the
+  // measuring has; the result then has canceled set.
+  void cancel();
+
+  bool await_ready() const { return ready(); }
+  bool await_suspend(std::coroutine_handle<> handle);
+  // Moves the result out.
+  AsyncResult await_resume();
+
+ private:
+  friend class SimpleDWrite;
+  struct State;
+  std::shared_ptr<State> state_;
+};
+
+// Measuring, rendering and atlas methods may be called from any number of
+// threads at once: each call in flight gets its own scratch buffers and
+// caches while the fonts are shared. Init, the cache settings, statistics
+// and Trim must not overlap other calls, and a DynamicAtlas must not be
+// updated from two threads at once.
+//
+// Once warmed up, CalcSize, Render and RenderInto do not allocate on the
+// SOFTWARE backend, whether the caches hit or miss. On the DIRECTWRITE
+// backend only layout and glyph cache hits avoid allocating: a miss
+// creates a text layout or a glyph run analysis.
 class SimpleDWriteImpl;
+class ThreadPool;
 class SimpleDWrite {
  public:
   SimpleDWrite();
+  explicit SimpleDWrite(Backend backend);
   virtual ~SimpleDWrite();
 
   bool Init(const FontSet& fs, float dpi = 96.0f);
-  bool CalcSize(const std::string& text, Layout& layout) const;
-  bool Render(const std::string& text, uint8_t* buffer, int buffer_size,
+  // |text| is UTF-8, UTF-16 or UTF-32. UTF-16 reaches the text layout as
+  // is; the others are converted into a per-thread buffer.
+  bool CalcSize(std::string_view text, Layout& layout) const;
+  bool CalcSize(std::u16string_view text, Layout& layout) const;
+  bool CalcSize(std::u32string_view text, Layout& layout) const;
+  bool Render(std::string_view text, uint8_t* buffer, int buffer_size,
+      Layout& layout, const RenderParams& renderparams = RenderParams()) const;
+  bool Render(std::u16string_view text, uint8_t* buffer, int buffer_size,
       Layout& layout, const RenderParams& renderparams = RenderParams()) const;
+  bool Render(std::u32string_view text, uint8_t* buffer, int buffer_size,
+      Layout& layout, const RenderParams& renderparams = RenderParams()) const;
+  // Renders into the rectangle at (x, y) of |surface|, which is filled with
+  // the background color first. Parts outside the surface are clipped.
+  bool RenderInto(std::string_view text, const Surface& surface, int x, int y,
+      Layout& layout, const RenderParams& renderparams = RenderParams()) const;
+  bool RenderInto(std::u16string_view text, const Surface& surface, int x,
+      int y, Layout& layout,
+      const RenderParams& renderparams = RenderParams()) const;
+  bool RenderInto(std::u32string_view text, const Surface& surface, int x,
+      int y, Layout& layout,
+      const RenderParams& renderparams = RenderParams()) const;
+  // Draws |glyphrun| on a single line without shaping or wrapping. The face
+  // is picked by the Layout font_weight/font_style/font_stretch, the output
+  // is as wide as the advances and as tall as the font's line height.
+  bool RenderGlyphRun(const GlyphRun& glyphrun, uint8_t* buffer,
+      int buffer_size, Layout& layout,
+      const RenderParams& renderparams = RenderParams()) const;
+  // CalcSize / Render on a worker thread, returning at once. |text| is
+  // copied; the output buffer is allocated for the result.
+  AsyncTask CalcSizeAsync(const std::string& text, const Layout& layout) const;
+  AsyncTask RenderAsync(const std::string& text, const Layout& layout,
+      const RenderParams& renderparams = RenderParams()) const;
+  // CalcSize of every string of |texts| with the inputs of |layout|, run on
+  // worker threads when there are many. Returns false if any failed.
+  bool CalcSizeBatch(std::span<const std::string> texts, const Layout& layout,
+      BatchMetrics& metrics) const;
+  // Measures then renders |items| on worker threads. The images go back to
+  // back, 16-byte aligned, into |buffer|, which is resized once for all of
+  // them. Returns false if any item failed; the others are still rendered.
+  bool RenderBatch(
+      std::span<BatchItem> items, std::vector<uint8_t>& buffer) const;
+  // Rasterizes every codepoint of |params.ranges| any font (or fallback)
+  // has, packing them into as many pages as needed.
+  bool BuildAtlas(const AtlasParams& params, Atlas& atlas) const;
+  // Adds the codepoints of |text| missing from |atlas| and marks all of
+  // them used. Fails if they do not fit without evicting glyphs used in
+  // this frame.
+  bool UpdateAtlas(const std::string& text, DynamicAtlas& atlas) const;
+  // Lays out |text| like Render and appends a quad per inked glyph to
+  // |quads|, with (x, y) being the top-left of the Render output. Glyphs are
+  // scaled by layout.font_size over the atlas font size, so SDF/MSDF atlases
+  // serve any size. Codepoints missing from |atlas| are skipped. The quads
+  // take renderparams.foreground_color.
+  bool RenderToQuads(const std::string& text, const Atlas& atlas, float x,
+      float y, Layout& layout, std::vector<GlyphQuad>& quads,
+      const RenderParams& renderparams = RenderParams()) const;
+  // Same, after adding the glyphs of |text| to |atlas| as UpdateAtlas does.
+  bool RenderToQuads(const std::string& text, DynamicAtlas& atlas, float x,
+      float y, Layout& layout, std::vector<GlyphQuad>& quads,
+      const RenderParams& renderparams = RenderParams()) const;
+  // Field value (0..1) at the outer edge of a params.renderparams
+  // outline_width outline in an SDF/MSDF atlas; the fill edge is 0.5.
+  float SdfOutlineThreshold(const AtlasParams& params) const;
+  // Message and status of the last call that failed on this instance;
+  // successful calls leave them alone.
   std::string GetLastError() const;
+  Status GetLastStatus() const;
+  Backend GetBackend() const;
+  std::vector<FontStats> GetFontStats() const;
+  // Upper bound of the glyph coverage cache in bytes, 0 disables caching.
+  // Each thread context has its own cache of this budget.
+  void SetGlyphCacheBudget(size_t bytes);
+  // Summed over the thread contexts; budget is per context.
+  GlyphCacheStats GetGlyphCacheStats() const;
+  // Number of laid out strings kept for CalcSize/Render, 0 disables caching.
+  // Each thread context has its own cache of this capacity.
+  void SetLayoutCacheCapacity(size_t entries);
+  // Summed over the thread contexts; capacity is per context.
+  LayoutCacheStats GetLayoutCacheStats() const;
+  // Releases the scratch buffers kept between Render calls. They are
+  // recreated on demand.
+  void Trim();
 
  private:
+  void setLastError(Status status, const char* message) const;
+  void setLastError(const std::exception& ex) const;
+  // Worker threads of the batch calls, started on first use.
+  ThreadPool& pool() const;
+  // Worker threads of the async calls, so that a continuation never runs
+  // on a thread that is helping a batch call.
+  ThreadPool& asyncPool() const;
+
+  mutable std::mutex last_error_mutex_;
   mutable std::string last_error_;
+  mutable Status last_status_ = Status::OK;
   FontSet fs_;
   float dpi_;
+  Backend backend_;
 
   std::unique_ptr<SimpleDWriteImpl> impl;
+  mutable std::unique_ptr<ThreadPool> pool_;
+  mutable std::once_flag pool_once_;
+  mutable std::unique_ptr<ThreadPool> async_pool_;
+  mutable std::once_flag async_pool_once_;
 };
 
 }  // namespace simpledwrite
@@ -0,0 +1,498 @@
+#include "simpledwrite_atlas.h"
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+namespace simpledwrite {
+
+void SkylinePacker::reset(int width, int height) {
+  width_ = width;
+  height_ = height;
+  skyline_.assign(1, Segment{0, 0, width});
+}
+
+int SkylinePacker::fit(size_t index, int width, int height) const {
+  const int x = skyline_[index].x;
+  if (x + width > width_) {
+    return -1;
+  }
+  int y = 0;
+  int remaining = width;
+  for (size_t i = index; remaining > 0; ++i) {
+    y = std::max(y, skyline_[i].y);
+    if (y + height > height_) {
+      return -1;
+    }
+    remaining -= skyline_[i].width;
+  }
+  return y;
+}
+
+bool SkylinePacker::insert(int width, int height, int& x, int& y) {
+  size_t best = SIZE_MAX;
+  int best_bottom = INT_MAX;
+  int best_width = INT_MAX;
+  for (size_t i = 0; i < skyline_.size(); ++i) {
+    const int top = fit(i, width, height);
+    if (top < 0) {
+      continue;
+    }
+    // Lowest bottom edge, then the narrowest segment to keep gaps small.
+    if (top + height < best_bottom ||
+        (top + height == best_bottom && skyline_[i].width < best_width)) {
+      best = i;
+      best_bottom = top + height;
+      best_width = skyline_[i].width;
+    }
+  }
+  if (best == SIZE_MAX) {
+    return false;
+  }
+  x = skyline_[best].x;
+  y = best_bottom - height;
+
+  // The new segment covers the next ones up to its right edge.
+  skyline_.insert(skyline_.begin() + best, Segment{x, best_bottom, width});
+  const int right = x + width;
+  for (size_t i = best + 1; i < skyline_.size();) {
+    Segment& segment = skyline_[i];
+    if (segment.x >= right) {
+      break;
+    }
+    const int covered = right - segment.x;
+    if (covered >= segment.width) {
+      skyline_.erase(skyline_.begin() + i);
+      continue;
+    }
+    segment.x += covered;
+    segment.width -= covered;
+    break;
+  }
+  for (size_t i = 0; i + 1 < skyline_.size();) {
+    if (skyline_[i].y == skyline_[i + 1].y) {
+      skyline_[i].width += skyline_[i + 1].width;
+      skyline_.erase(skyline_.begin() + i + 1);
+    } else {
+      ++i;
+    }
+  }
+  return true;
+}
+
+namespace {
+
+// Distance fields fix the format: one channel for SDF, four for MSDF.
+PixelFormat page_format(const AtlasParams& params) {
+  switch (params.mode) {
+    case AtlasMode::SDF:
+      return PixelFormat::A8;
+    case AtlasMode::MSDF:
+      return PixelFormat::BGRA_PREMULTIPLIED;
+    default:
+      return params.renderparams.pixel_format;
+  }
+}
+
+void check_params(const AtlasParams& params) {
+  const PixelFormat format = page_format(params);
+  if (format != PixelFormat::A8 && format != PixelFormat::BGRA_PREMULTIPLIED) {
+    throw Error(Status::INVALID_ARGUMENT,
+        "AtlasParams pixel_format must be A8 or BGRA_PREMULTIPLIED.");
+  }
+  if (params.page_width <= 0 || params.page_height <= 0 ||
+      params.padding < 0) {
+    throw Error(Status::INVALID_ARGUMENT, "invalid AtlasParams page size.");
+  }
+  if (params.mode != AtlasMode::COVERAGE && !(params.sdf_range > 0.0f)) {
+    throw Error(Status::INVALID_ARGUMENT,
+        "AtlasParams sdf_range must be positive.");
+  }
+}
+
+AtlasPage create_page(const AtlasParams& params) {
+  AtlasPage page;
+  page.width = params.page_width;
+  page.height = params.page_height;
+  page.pixel_format = page_format(params);
+  page.pixels.assign((size_t)page.width * page.height *
+                         BytesPerPixel(page.pixel_format),
+      0);
+  return page;
+}
+
+AtlasGlyph glyph_metrics(uint32_t codepoint, const GlyphImage& image) {
+  AtlasGlyph glyph;
+  glyph.codepoint = codepoint;
+  glyph.width = image.width;
+  glyph.height = image.height;
+  glyph.advance = image.advance;
+  glyph.bearing_x = (float)image.left;
+  glyph.bearing_y = (float)-image.top;
+  glyph.vertical_offset = image.vertical_offset;
+  return glyph;
+}
+
+bool has_ink(const GlyphImage& image) {
+  return image.width > 0 && image.height > 0;
+}
+
+// Writes |image| into |rect| of |page| with |padding| cleared texels around
+// it and points |glyph| there.
+void place_glyph(const GlyphImage& image, const AtlasRect& rect, int padding,
+    AtlasPage& page, AtlasGlyph& glyph) {
+  const int bpp = BytesPerPixel(page.pixel_format);
+  const size_t stride = (size_t)page.width * bpp;
+  for (int i = 0; i < rect.height; ++i) {
+    auto row = page.pixels.begin() + (rect.y + i) * stride + rect.x * bpp;
+    std::fill(row, row + (size_t)rect.width * bpp, 0);
+  }
+  glyph.page = rect.page;
+  glyph.x = rect.x + padding;
+  glyph.y = rect.y + padding;
+  const size_t row = (size_t)image.width * bpp;
+  for (int i = 0; i < image.height; ++i) {
+    std::copy(image.pixels.begin() + i * row,
+        image.pixels.begin() + (i + 1) * row,
+        page.pixels.begin() + (glyph.y + i) * stride + glyph.x * bpp);
+  }
+  glyph.u0 = (float)glyph.x / page.width;
+  glyph.v0 = (float)glyph.y / page.height;
+  glyph.u1 = (float)(glyph.x + glyph.width) / page.width;
+  glyph.v1 = (float)(glyph.y + glyph.height) / page.height;
+}
+
+}  // namespace
+
+void build_atlas(SimpleDWriteImpl& impl, const FontSet& fs, float dpi,
+    const AtlasParams& params, Atlas& atlas) {
+  check_params(params);
+
+  std::vector<uint32_t> codepoints;
+  for (const std::pair<uint32_t, uint32_t>& range : params.ranges) {
+    const uint32_t last = std::min<uint32_t>(range.second, 0x10ffff);
+    for (uint32_t c = range.first; c <= last; ++c) {
+      if (c < 0xd800 || c >= 0xe000) {
+        codepoints.push_back(c);
+      }
+    }
+  }
+  std::sort(codepoints.begin(), codepoints.end());
+  codepoints.erase(
+      std::unique(codepoints.begin(), codepoints.end()), codepoints.end());
+
+  atlas.pages.clear();
+  atlas.glyphs.clear();
+  atlas.font_size = params.layout.font_size;
+  const int padding = params.padding;
+  SkylinePacker packer;
+  GlyphImage image;
+  for (uint32_t c : codepoints) {
+    if (!impl.rasterizeGlyph(fs, dpi, c, params, image)) {
+      continue;
+    }
+    AtlasGlyph glyph = glyph_metrics(c, image);
+    if (has_ink(image)) {
+      AtlasRect rect;
+      rect.width = image.width + padding * 2;
+      rect.height = image.height + padding * 2;
+      if (rect.width > params.page_width || rect.height > params.page_height) {
+        throw Error(Status::INVALID_ARGUMENT,
+            "glyph is larger than the atlas page.");
+      }
+      if (atlas.pages.empty() ||
+          !packer.insert(rect.width, rect.height, rect.x, rect.y)) {
+        atlas.pages.push_back(create_page(params));
+        packer.reset(params.page_width, params.page_height);
+        packer.insert(rect.width, rect.height, rect.x, rect.y);
+      }
+      rect.page = (int)atlas.pages.size() - 1;
+      place_glyph(image, rect, padding, atlas.pages.back(), glyph);
+    }
+    atlas.glyphs.push_back(glyph);
+  }
+}
+
+void append_quads(const std::vector<PlacedGlyph>& placed,
+    const std::function<const AtlasGlyph*(uint32_t)>& find, float scale,
+    float x, float y, const Color& color, std::vector<GlyphQuad>& quads) {
+  for (const PlacedGlyph& pen : placed) {
+    const AtlasGlyph* glyph = find(pen.codepoint);
+    if (glyph == nullptr || glyph->page < 0) {
+      continue;
+    }
+    GlyphQuad quad;
+    quad.page = glyph->page;
+    quad.x0 = x + pen.x + glyph->bearing_x * scale;
+    // vertical_offset does not depend on the font size.
+    quad.y0 = y + pen.y + glyph->vertical_offset - glyph->bearing_y * scale;
+    quad.x1 = quad.x0 + glyph->width * scale;
+    quad.y1 = quad.y0 + glyph->height * scale;
+    quad.u0 = glyph->u0;
+    quad.v0 = glyph->v0;
+    quad.u1 = glyph->u1;
+    quad.v1 = glyph->v1;
+    quad.color = color;
+    quads.push_back(quad);
+  }
+}
+
+DynamicAtlasImpl::DynamicAtlasImpl(const AtlasParams& params, int max_pages)
+    : params_(params), max_pages_(std::max(1, max_pages)) {}
+
+void DynamicAtlasImpl::beginFrame() {
+  ++frame_;
+  dirty_.clear();
+}
+
+const AtlasGlyph* DynamicAtlasImpl::find(uint32_t codepoint) {
+  auto it = glyphs_.find(codepoint);
+  if (it == glyphs_.end()) {
+    return nullptr;
+  }
+  touch(it->second);
+  return &it->second.glyph;
+}
+
+void DynamicAtlasImpl::update(SimpleDWriteImpl& impl, const FontSet& fs,
+    float dpi, std::u16string_view text) {
+  check_params(params_);
+  const int padding = params_.padding;
+  for (size_t i = 0; i < text.size(); ++i) {
+    uint32_t c = text[i];
+    if (c >= 0xd800 && c < 0xdc00 && i + 1 < text.size() &&
+        text[i + 1] >= 0xdc00 && text[i + 1] < 0xe000) {
+      c = 0x10000 + ((c - 0xd800) << 10) + (text[++i] - 0xdc00);
+    }
+    if (c < 0x20) {
+      continue;
+    }
+    auto it = glyphs_.find(c);
+    if (it != glyphs_.end()) {
+      touch(it->second);
+      continue;
+    }
+    if (missing_.count(c)) {
+      continue;
+    }
+    if (!impl.rasterizeGlyph(fs, dpi, c, params_, image_)) {
+      missing_.insert(c);
+      continue;
+    }
+
+    Entry entry;
+    entry.glyph = glyph_metrics(c, image_);
+    if (has_ink(image_)) {
+      const int width = image_.width + padding * 2;
+      const int height = image_.height + padding * 2;
+      if (width > params_.page_width || height > params_.page_height) {
+        throw Error(Status::INVALID_ARGUMENT,
+            "glyph is larger than the atlas page.");
+      }
+      if (!allocate(width, height, entry.slot)) {
+        throw Error(Status::ATLAS_FULL, "atlas is full.");
+      }
+      place_glyph(image_, entry.slot, padding, pages_[entry.slot.page],
+          entry.glyph);
+      dirty_.push_back(entry.slot);
+      ++spaces_[entry.slot.page].glyphs;
+    }
+    entry.frame = frame_;
+    lru_.push_front(c);
+    entry.lru = lru_.begin();
+    glyphs_.emplace(c, entry);
+  }
+}
+
+void DynamicAtlasImpl::touch(Entry& entry) {
+  entry.frame = frame_;
+  lru_.splice(lru_.begin(), lru_, entry.lru);
+}
+
+bool DynamicAtlasImpl::allocate(int width, int height, AtlasRect& rect) {
+  bool compacted = false;
+  for (;;) {
+    if (allocateFree(width, height, rect)) {
+      return true;
+    }
+    if ((int)pages_.size() < max_pages_) {
+      pages_.push_back(create_page(params_));
+      spaces_.emplace_back();
+      spaces_.back().packer.reset(params_.page_width, params_.page_height);
+      continue;
+    }
+    if (evict()) {
+      continue;
+    }
+    // Only glyphs of this frame are left; repack them to merge the holes
+    // their evicted neighbours left.
+    if (compacted || !compact()) {
+      return false;
+    }
+    compacted = true;
+  }
+}
+
+bool DynamicAtlasImpl::allocateFree(int width, int height, AtlasRect& rect) {
+  for (size_t i = 0; i < spaces_.size(); ++i) {
+    if (spaces_[i].packer.insert(width, height, rect.x, rect.y)) {
+      rect.page = (int)i;
+      rect.width = width;
+      rect.height = height;
+      return true;
+    }
+  }
+  // Smallest slot of an evicted glyph that holds the rect; the rest of it
+  // is split off to the right and below.
+  PageSpace* best_space = nullptr;
+  size_t best = 0;
+  for (PageSpace& space : spaces_) {
+    for (size_t i = 0; i < space.free.size(); ++i) {
+      const AtlasRect& slot = space.free[i];
+      if (slot.width < width || slot.height < height) {
+        continue;
+      }
+      if (best_space == nullptr ||
+          slot.width * slot.height <
+              best_space->free[best].width * best_space->free[best].height) {
+        best_space = &space;
+        best = i;
+      }
+    }
+  }
+  if (best_space == nullptr) {
+    return false;
+  }
+  const AtlasRect slot = best_space->free[best];
+  best_space->free.erase(best_space->free.begin() + best);
+  if (slot.width > width) {
+    best_space->free.push_back(AtlasRect{
+        slot.page, slot.x + width, slot.y, slot.width - width, height});
+  }
+  if (slot.height > height) {
+    best_space->free.push_back(AtlasRect{
+        slot.page, slot.x, slot.y + height, slot.width, slot.height - height});
+  }
+  rect = AtlasRect{slot.page, slot.x, slot.y, width, height};
+  return true;
+}
+
+bool DynamicAtlasImpl::compact() {
+  const int bpp = BytesPerPixel(page_format(params_));
+  bool compacted = false;
+  for (size_t page = 0; page < pages_.size(); ++page) {
+    std::vector<Entry*> entries;
+    for (auto& [codepoint, entry] : glyphs_) {
+      if (entry.glyph.page == (int)page) {
+        entries.push_back(&entry);
+      }
+    }
+    std::sort(entries.begin(), entries.end(), [](Entry* a, Entry* b) {
+      return a->slot.height > b->slot.height;
+    });
+    // A set that fitted before need not fit a fresh skyline, so place every
+    // glyph first and leave the page as it is if one does not fit.
+    SkylinePacker packer;
+    packer.reset(params_.page_width, params_.page_height);
+    std::vector<AtlasRect> slots(entries.size());
+    bool fits = true;
+    for (size_t i = 0; i < entries.size() && fits; ++i) {
+      slots[i] = entries[i]->slot;
+      fits = packer.insert(
+          slots[i].width, slots[i].height, slots[i].x, slots[i].y);
+    }
+    if (!fits) {
+      continue;
+    }
+
+    const std::vector<uint8_t> pixels = pages_[page].pixels;
+    const size_t stride = (size_t)params_.page_width * bpp;
+    PageSpace& space = spaces_[page];
+    space.packer = packer;
+    space.free.clear();
+    std::fill(pages_[page].pixels.begin(), pages_[page].pixels.end(), 0);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      AtlasRect& slot = entries[i]->slot;
+      const int x = slot.x;
+      const int y = slot.y;
+      slot = slots[i];
+      for (int row = 0; row < slot.height; ++row) {
+        std::copy_n(pixels.begin() + (y + row) * stride + x * bpp,
+            (size_t)slot.width * bpp,
+            pages_[page].pixels.begin() + (slot.y + row) * stride +
+                slot.x * bpp);
+      }
+      AtlasGlyph& glyph = entries[i]->glyph;
+      glyph.x += slot.x - x;
+      glyph.y += slot.y - y;
+      glyph.u0 = (float)glyph.x / params_.page_width;
+      glyph.v0 = (float)glyph.y / params_.page_height;
+      glyph.u1 = (float)(glyph.x + glyph.width) / params_.page_width;
+      glyph.v1 = (float)(glyph.y + glyph.height) / params_.page_height;
+    }
+    dirty_.push_back(AtlasRect{
+        (int)page, 0, 0, params_.page_width, params_.page_height});
+    compacted = true;
+  }
+  return compacted;
+}
+
+bool DynamicAtlasImpl::evict() {
+  if (lru_.empty()) {
+    return false;
+  }
+  const uint32_t c = lru_.back();
+  auto it = glyphs_.find(c);
+  const Entry& entry = it->second;
+  if (entry.frame == frame_) {
+    return false;
+  }
+  if (entry.glyph.page >= 0) {
+    PageSpace& space = spaces_[entry.slot.page];
+    if (--space.glyphs == 0) {
+      space.packer.reset(params_.page_width, params_.page_height);
+      space.free.clear();
+    } else {
+      space.free.push_back(entry.slot);
+    }
+  }
+  lru_.pop_back();
+  glyphs_.erase(it);
+  ++evictions_;
+  return true;
+}
+
+const AtlasGlyph* Atlas::Find(uint32_t codepoint) const {
+  auto it = std::lower_bound(glyphs.begin(), glyphs.end(), codepoint,
+      [](const AtlasGlyph& glyph, uint32_t c) { return glyph.codepoint < c; });
+  if (it == glyphs.end() || it->codepoint != codepoint) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+
+DynamicAtlas::DynamicAtlas(const AtlasParams& params, int max_pages)
+    : impl(std::make_unique<DynamicAtlasImpl>(params, max_pages)) {}
+
+DynamicAtlas::~DynamicAtlas() {}
+
+void DynamicAtlas::BeginFrame() { impl->beginFrame(); }
+
+const AtlasGlyph* DynamicAtlas::Find(uint32_t codepoint) {
+  return impl->find(codepoint);
+}
+
+const std::vector<AtlasPage>& DynamicAtlas::Pages() const {
+  return impl->pages();
+}
+
+const std::vector<AtlasRect>& DynamicAtlas::DirtyRects() const {
+  return impl->dirtyRects();
+}
+
+size_t DynamicAtlas::GlyphCount() const { return impl->size(); }
+
+uint64_t DynamicAtlas::Evictions() const { return impl->evictions(); }
+
+}  // namespace simpledwrite
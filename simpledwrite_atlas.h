@@ -0,0 +1,106 @@
+#pragma once
+
+// simpledwrite glyph atlas packing
+// https://github.com/fecf/simpledwrite
+
+#include <functional>
+#include <list>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "simpledwrite.h"
+#include "simpledwrite_impl.h"
+
+namespace simpledwrite {
+
+// Skyline bottom-left rectangle packer: the free space is the region above
+// a list of horizontal segments, and each rectangle goes where its bottom
+// edge lands lowest.
+class SkylinePacker {
+ public:
+  void reset(int width, int height);
+  // Returns false if a width x height rectangle does not fit anymore.
+  bool insert(int width, int height, int& x, int& y);
+
+ private:
+  struct Segment {
+    int x;
+    int y;
+    int width;
+  };
+
+  // Top of a rectangle placed at segment |index|, or -1 if it does not fit.
+  int fit(size_t index, int width, int height) const;
+
+  std::vector<Segment> skyline_;
+  int width_ = 0;
+  int height_ = 0;
+};
+
+// SimpleDWrite::BuildAtlas on top of SimpleDWriteImpl::rasterizeGlyph.
+void build_atlas(SimpleDWriteImpl& impl, const FontSet& fs, float dpi,
+    const AtlasParams& params, Atlas& atlas);
+
+// Appends the quads of SimpleDWrite::RenderToQuads. |scale| is the layout
+// font size over the atlas one.
+void append_quads(const std::vector<PlacedGlyph>& placed,
+    const std::function<const AtlasGlyph*(uint32_t)>& find, float scale,
+    float x, float y, const Color& color, std::vector<GlyphQuad>& quads);
+
+class DynamicAtlasImpl {
+ public:
+  DynamicAtlasImpl(const AtlasParams& params, int max_pages);
+
+  void beginFrame();
+  const AtlasGlyph* find(uint32_t codepoint);
+  // Rasterizes the codepoints of |text| not in the atlas yet.
+  void update(SimpleDWriteImpl& impl, const FontSet& fs, float dpi,
+      std::u16string_view text);
+
+  const AtlasParams& params() const { return params_; }
+  const std::vector<AtlasPage>& pages() const { return pages_; }
+  const std::vector<AtlasRect>& dirtyRects() const { return dirty_; }
+  size_t size() const { return glyphs_.size(); }
+  uint64_t evictions() const { return evictions_; }
+
+ private:
+  struct Entry {
+    AtlasGlyph glyph;
+    AtlasRect slot;      // space taken in the page, padding included
+    uint64_t frame = 0;  // last frame the glyph was used in
+    std::list<uint32_t>::iterator lru;
+  };
+  struct PageSpace {
+    SkylinePacker packer;
+    std::vector<AtlasRect> free;  // rects of evicted glyphs, with padding
+    int glyphs = 0;
+  };
+
+  void touch(Entry& entry);
+  // Finds room for a width x height rect, evicting glyphs of past frames
+  // if needed. Returns false if that is not enough.
+  bool allocate(int width, int height, AtlasRect& rect);
+  // Skyline space of any page, else a slot freed by eviction.
+  bool allocateFree(int width, int height, AtlasRect& rect);
+  // Evicts the least recently used glyph unless it was used this frame.
+  bool evict();
+  // Repacks every page whose glyphs all fit a fresh skyline; glyphs keep
+  // their texels but may move. Returns false if no page was repacked.
+  bool compact();
+
+  AtlasParams params_;
+  int max_pages_;
+  std::vector<AtlasPage> pages_;
+  std::vector<PageSpace> spaces_;
+  std::unordered_map<uint32_t, Entry> glyphs_;
+  std::list<uint32_t> lru_;  // most recently used first
+  std::unordered_set<uint32_t> missing_;  // codepoints no font has
+  std::vector<AtlasRect> dirty_;
+  uint64_t frame_ = 1;
+  uint64_t evictions_ = 0;
+  GlyphImage image_;
+};
+
+}  // namespace simpledwrite
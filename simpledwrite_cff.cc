@@ -0,0 +1,679 @@
+#include "simpledwrite_cff.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+namespace simpledwrite {
+
+namespace {
+
+enum : uint16_t {
+  kDictCharStrings = 17,
+  kDictPrivate = 18,
+  kDictSubrs = 19,
+  kDictVsindex = 22,
+  kDictVstore = 24,
+  kDictCharstringType = 0x0c06,
+  kDictFDArray = 0x0c24,
+  kDictFDSelect = 0x0c25,
+};
+
+int subr_bias(size_t count) {
+  return count < 1240 ? 107 : count < 33900 ? 1131 : 32768;
+}
+
+// Calls |fn(op, operands, count)| for every operator of a DICT.
+template <typename Fn>
+bool parse_dict(const uint8_t* p, const uint8_t* end, Fn fn) {
+  double operands[48];
+  int count = 0;
+  while (p < end) {
+    const uint8_t b = *p++;
+    if (b < 28) {
+      uint16_t op = b;
+      if (b == 12) {
+        if (p >= end) {
+          return false;
+        }
+        op = 0x0c00 | *p++;
+      }
+      fn(op, operands, count);
+      count = 0;
+      continue;
+    }
+    double value = 0.0;
+    if (b == 28) {
+      if (end - p < 2) {
+        return false;
+      }
+      value = read_i16(p);
+      p += 2;
+    } else if (b == 29) {
+      if (end - p < 4) {
+        return false;
+      }
+      value = (int32_t)read_u32(p);
+      p += 4;
+    } else if (b == 30) {
+      static const char* nibbles[] = {"0", "1", "2", "3", "4", "5", "6", "7",
+          "8", "9", ".", "E", "E-", "", "-", ""};
+      std::string str;
+      bool done = false;
+      while (!done && p < end) {
+        const uint8_t byte = *p++;
+        for (int nibble : {byte >> 4, byte & 0x0f}) {
+          if (nibble == 0x0f) {
+            done = true;
+            break;
+          }
+          str += nibbles[nibble];
+        }
+      }
+      value = std::strtod(str.c_str(), nullptr);
+    } else if (b >= 32 && b <= 246) {
+      value = b - 139;
+    } else if (b >= 247 && b <= 250) {
+      if (p >= end) {
+        return false;
+      }
+      value = (b - 247) * 256 + *p++ + 108;
+    } else if (b >= 251 && b <= 254) {
+      if (p >= end) {
+        return false;
+      }
+      value = -(b - 251) * 256 - *p++ - 108;
+    } else {
+      return false;
+    }
+    if (count < 48) {
+      operands[count++] = value;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+// Executes Type 2 charstrings (CFF and CFF2 flavours). Hints are skipped;
+// the advance width operand of CFF1 is ignored since widths come from hmtx.
+class CharstringInterpreter {
+ public:
+  CharstringInterpreter(const CffFont& font, const CffFont::FontDict& fd,
+      OutlineSink& sink)
+      : font_(font), fd_(fd), sink_(sink), vsindex_(fd.vsindex) {}
+
+  bool run(uint32_t begin, uint32_t end) {
+    if (!execute(begin, end, 0)) {
+      return false;
+    }
+    closeContour();
+    return true;
+  }
+
+ private:
+  static constexpr int kMaxStack = 513;
+  static constexpr int kMaxDepth = 10;
+
+  void moveTo(float dx, float dy) {
+    closeContour();
+    x_ += dx;
+    y_ += dy;
+    sink_.moveTo(x_, y_);
+    open_ = true;
+  }
+  void lineTo(float dx, float dy) {
+    x_ += dx;
+    y_ += dy;
+    sink_.lineTo(x_, y_);
+  }
+  void curveTo(
+      float dx0, float dy0, float dx1, float dy1, float dx2, float dy2) {
+    const float x0 = x_ + dx0;
+    const float y0 = y_ + dy0;
+    const float x1 = x0 + dx1;
+    const float y1 = y0 + dy1;
+    x_ = x1 + dx2;
+    y_ = y1 + dy2;
+    sink_.cubicTo(x0, y0, x1, y1, x_, y_);
+  }
+  void closeContour() {
+    if (open_) {
+      sink_.close();
+      open_ = false;
+    }
+  }
+
+  bool execute(uint32_t pos, uint32_t end, int depth) {
+    if (depth > kMaxDepth) {
+      return false;
+    }
+    const uint8_t* data = font_.data_;
+    while (pos < end) {
+      const uint8_t b0 = data[pos++];
+      if (b0 >= 32 || b0 == 28) {
+        float value = 0.0f;
+        if (b0 == 28) {
+          if (end - pos < 2) {
+            return false;
+          }
+          value = read_i16(data + pos);
+          pos += 2;
+        } else if (b0 <= 246) {
+          value = (float)(b0 - 139);
+        } else if (b0 <= 250) {
+          if (pos >= end) {
+            return false;
+          }
+          value = (float)((b0 - 247) * 256 + data[pos++] + 108);
+        } else if (b0 <= 254) {
+          if (pos >= end) {
+            return false;
+          }
+          value = (float)(-(b0 - 251) * 256 - data[pos++] - 108);
+        } else {
+          if (end - pos < 4) {
+            return false;
+          }
+          value = (int32_t)read_u32(data + pos) / 65536.0f;
+          pos += 4;
+        }
+        if (sp_ >= kMaxStack) {
+          return false;
+        }
+        stack_[sp_++] = value;
+        continue;
+      }
+
+      const float* s = stack_;
+      int i = 0;
+      switch (b0) {
+        case 1:    // hstem
+        case 3:    // vstem
+        case 18:   // hstemhm
+        case 23:   // vstemhm
+          stems_ += sp_ / 2;
+          break;
+        case 19:   // hintmask
+        case 20:   // cntrmask
+          if (in_header_) {
+            stems_ += sp_ / 2;
+          }
+          in_header_ = false;
+          pos += (stems_ + 7) / 8;
+          break;
+        case 21:   // rmoveto
+          if (sp_ < 2) {
+            return false;
+          }
+          in_header_ = false;
+          moveTo(s[sp_ - 2], s[sp_ - 1]);
+          break;
+        case 4:    // vmoveto
+          if (sp_ < 1) {
+            return false;
+          }
+          in_header_ = false;
+          moveTo(0.0f, s[sp_ - 1]);
+          break;
+        case 22:   // hmoveto
+          if (sp_ < 1) {
+            return false;
+          }
+          in_header_ = false;
+          moveTo(s[sp_ - 1], 0.0f);
+          break;
+        case 5:    // rlineto
+          for (; i + 1 < sp_; i += 2) {
+            lineTo(s[i], s[i + 1]);
+          }
+          break;
+        case 6:    // hlineto
+        case 7: {  // vlineto
+          bool horizontal = b0 == 6;
+          for (; i < sp_; ++i, horizontal = !horizontal) {
+            horizontal ? lineTo(s[i], 0.0f) : lineTo(0.0f, s[i]);
+          }
+          break;
+        }
+        case 30:   // vhcurveto
+        case 31: { // hvcurveto
+          bool horizontal = b0 == 31;
+          for (; i + 3 < sp_; i += 4, horizontal = !horizontal) {
+            const float last = (sp_ - i == 5) ? s[i + 4] : 0.0f;
+            if (horizontal) {
+              curveTo(s[i], 0.0f, s[i + 1], s[i + 2], last, s[i + 3]);
+            } else {
+              curveTo(0.0f, s[i], s[i + 1], s[i + 2], s[i + 3], last);
+            }
+          }
+          break;
+        }
+        case 8:    // rrcurveto
+          for (; i + 5 < sp_; i += 6) {
+            curveTo(s[i], s[i + 1], s[i + 2], s[i + 3], s[i + 4], s[i + 5]);
+          }
+          break;
+        case 24:   // rcurveline
+          for (; i + 5 < sp_ - 2; i += 6) {
+            curveTo(s[i], s[i + 1], s[i + 2], s[i + 3], s[i + 4], s[i + 5]);
+          }
+          if (i + 1 >= sp_) {
+            return false;
+          }
+          lineTo(s[i], s[i + 1]);
+          break;
+        case 25:   // rlinecurve
+          for (; i + 1 < sp_ - 6; i += 2) {
+            lineTo(s[i], s[i + 1]);
+          }
+          if (i + 5 >= sp_) {
+            return false;
+          }
+          curveTo(s[i], s[i + 1], s[i + 2], s[i + 3], s[i + 4], s[i + 5]);
+          break;
+        case 26:   // vvcurveto
+        case 27: { // hhcurveto
+          float f = 0.0f;
+          if (sp_ & 1) {
+            f = s[i++];
+          }
+          for (; i + 3 < sp_; i += 4, f = 0.0f) {
+            if (b0 == 27) {
+              curveTo(s[i], f, s[i + 1], s[i + 2], s[i + 3], 0.0f);
+            } else {
+              curveTo(f, s[i], s[i + 1], s[i + 2], 0.0f, s[i + 3]);
+            }
+          }
+          break;
+        }
+        case 10:   // callsubr
+        case 29: { // callgsubr
+          if (sp_ < 1) {
+            return false;
+          }
+          const CffFont::Subrs& subrs = b0 == 10 ? fd_.subrs : font_.gsubrs_;
+          const int index = (int)s[--sp_] + subrs.bias;
+          if (index < 0 || index + 1 >= (int)subrs.offsets.size()) {
+            return false;
+          }
+          if (!execute(subrs.offsets[index], subrs.offsets[index + 1],
+                  depth + 1)) {
+            return false;
+          }
+          if (ended_) {
+            return true;
+          }
+          continue;  // operands survive subroutine calls
+        }
+        case 11:   // return
+          return true;
+        case 14:   // endchar
+          ended_ = true;
+          return true;
+        case 15:   // vsindex (CFF2)
+          if (sp_ < 1) {
+            return false;
+          }
+          vsindex_ = (int)s[sp_ - 1];
+          break;
+        case 16: { // blend (CFF2): keep the default master values
+          if (sp_ < 1) {
+            return false;
+          }
+          const int n = (int)s[sp_ - 1];
+          const int regions = vsindex_ >= 0 &&
+                                      vsindex_ < (int)font_.regions_.size()
+                                  ? font_.regions_[vsindex_]
+                                  : 0;
+          const int base = sp_ - 1 - n * (regions + 1);
+          if (n < 0 || base < 0) {
+            return false;
+          }
+          sp_ = base + n;
+          continue;
+        }
+        case 12: { // escape
+          if (pos >= end) {
+            return false;
+          }
+          const uint8_t b1 = data[pos++];
+          if (b1 == 34 && sp_ >= 7) {  // hflex
+            curveTo(s[0], 0.0f, s[1], s[2], s[3], 0.0f);
+            curveTo(s[4], 0.0f, s[5], -s[2], s[6], 0.0f);
+          } else if (b1 == 35 && sp_ >= 12) {  // flex
+            curveTo(s[0], s[1], s[2], s[3], s[4], s[5]);
+            curveTo(s[6], s[7], s[8], s[9], s[10], s[11]);
+          } else if (b1 == 36 && sp_ >= 9) {  // hflex1
+            curveTo(s[0], s[1], s[2], s[3], s[4], 0.0f);
+            curveTo(s[5], 0.0f, s[6], s[7], s[8], -(s[1] + s[3] + s[7]));
+          } else if (b1 == 37 && sp_ >= 11) {  // flex1
+            const float dx = s[0] + s[2] + s[4] + s[6] + s[8];
+            const float dy = s[1] + s[3] + s[5] + s[7] + s[9];
+            curveTo(s[0], s[1], s[2], s[3], s[4], s[5]);
+            if (std::abs(dx) > std::abs(dy)) {
+              curveTo(s[6], s[7], s[8], s[9], s[10], -dy);
+            } else {
+              curveTo(s[6], s[7], s[8], s[9], -dx, s[10]);
+            }
+          } else {
+            // Arithmetic/storage operators are deprecated and unused by
+            // real fonts.
+            return false;
+          }
+          break;
+        }
+        default:
+          return false;
+      }
+      sp_ = 0;
+    }
+    return true;
+  }
+
+  const CffFont& font_;
+  const CffFont::FontDict& fd_;
+  OutlineSink& sink_;
+  float stack_[kMaxStack];
+  int sp_ = 0;
+  int stems_ = 0;
+  int vsindex_ = 0;
+  bool in_header_ = true;
+  bool ended_ = false;
+  bool open_ = false;
+  float x_ = 0.0f;
+  float y_ = 0.0f;
+};
+
+bool CffFont::readIndex(uint32_t pos, Index& index) const {
+  index = Index();
+  const uint32_t header = cff2_ ? 4 : 2;
+  if ((size_t)pos + header > size_) {
+    return false;
+  }
+  index.count = cff2_ ? read_u32(data_ + pos) : read_u16(data_ + pos);
+  if (index.count == 0) {
+    index.end = pos + header;
+    return true;
+  }
+  if ((size_t)pos + header + 1 > size_) {
+    return false;
+  }
+  index.off_size = data_[pos + header];
+  if (index.off_size < 1 || index.off_size > 4) {
+    return false;
+  }
+  index.offsets = pos + header + 1;
+  const size_t data = (size_t)index.offsets +
+                      ((size_t)index.count + 1) * index.off_size - 1;
+  if (data >= size_) {
+    return false;
+  }
+  index.data = (uint32_t)data;
+  uint32_t begin = 0;
+  uint32_t end = 0;
+  if (!indexEntry(index, index.count - 1, begin, end)) {
+    return false;
+  }
+  index.end = end;
+  return true;
+}
+
+bool CffFont::indexEntry(
+    const Index& index, uint32_t i, uint32_t& begin, uint32_t& end) const {
+  if (i >= index.count) {
+    return false;
+  }
+  auto offset = [&](uint32_t k) {
+    const uint8_t* p = data_ + index.offsets + (size_t)k * index.off_size;
+    uint32_t value = 0;
+    for (int j = 0; j < index.off_size; ++j) {
+      value = (value << 8) | p[j];
+    }
+    return value;
+  };
+  const size_t b = (size_t)index.data + offset(i);
+  const size_t e = (size_t)index.data + offset(i + 1);
+  if (b > e || e > size_) {
+    return false;
+  }
+  begin = (uint32_t)b;
+  end = (uint32_t)e;
+  return true;
+}
+
+bool CffFont::decodeSubrs(uint32_t pos, Subrs& subrs) const {
+  Index index;
+  if (!readIndex(pos, index)) {
+    return false;
+  }
+  subrs.offsets.resize(index.count ? index.count + 1 : 0);
+  for (uint32_t i = 0; i < index.count; ++i) {
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    if (!indexEntry(index, i, begin, end)) {
+      return false;
+    }
+    subrs.offsets[i] = begin;
+    subrs.offsets[i + 1] = end;
+  }
+  subrs.bias = subr_bias(index.count);
+  return true;
+}
+
+bool CffFont::loadPrivate(uint32_t begin, uint32_t end, FontDict& dict) const {
+  if (begin > end || end > size_) {
+    return false;
+  }
+  uint32_t subrs = 0;
+  bool ok = parse_dict(data_ + begin, data_ + end,
+      [&](uint16_t op, const double* operands, int count) {
+        if (op == kDictSubrs && count >= 1) {
+          subrs = (uint32_t)operands[0];
+        } else if (op == kDictVsindex && count >= 1) {
+          dict.vsindex = (int)operands[0];
+        }
+      });
+  if (ok && subrs) {
+    ok = decodeSubrs(begin + subrs, dict.subrs);
+  }
+  return ok;
+}
+
+bool CffFont::loadFDSelect(uint32_t pos, int num_glyphs) {
+  if ((size_t)pos + 1 > size_) {
+    return false;
+  }
+  fdselect_.assign(num_glyphs, 0);
+  const uint8_t* p = data_ + pos;
+  const size_t avail = size_ - pos;
+  switch (p[0]) {
+    case 0:
+      if (1 + (size_t)num_glyphs > avail) {
+        return false;
+      }
+      fdselect_.assign(p + 1, p + 1 + num_glyphs);
+      return true;
+    case 3:
+    case 4: {
+      const bool wide = p[0] == 4;
+      const size_t header = wide ? 5 : 3;
+      const size_t range = wide ? 6 : 3;
+      if (header > avail) {
+        return false;
+      }
+      const uint32_t count = wide ? read_u32(p + 1) : read_u16(p + 1);
+      if (header + range * count + (wide ? 4 : 2) > avail) {
+        return false;
+      }
+      for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t* r = p + header + range * i;
+        const uint32_t first = wide ? read_u32(r) : read_u16(r);
+        const uint16_t fd = wide ? read_u16(r + 4) : r[2];
+        const uint8_t* next = r + range;
+        const uint32_t last = wide ? read_u32(next) : read_u16(next);
+        for (uint32_t g = first; g < last && g < (uint32_t)num_glyphs; ++g) {
+          fdselect_[g] = (uint8_t)fd;
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void CffFont::loadVariationStore(uint32_t pos) {
+  // u16 length, then an ItemVariationStore.
+  const size_t store = (size_t)pos + 2;
+  if (store + 8 > size_ || read_u16(data_ + store) != 1) {
+    return;
+  }
+  const uint16_t count = read_u16(data_ + store + 6);
+  if (store + 8 + 4 * (size_t)count > size_) {
+    return;
+  }
+  for (uint16_t i = 0; i < count; ++i) {
+    const size_t item = store + read_u32(data_ + store + 8 + 4 * i);
+    regions_.push_back(item + 6 <= size_ ? read_u16(data_ + item + 4) : 0);
+  }
+}
+
+bool CffFont::load(
+    const uint8_t* table, size_t size, bool cff2, int num_glyphs) {
+  data_ = table;
+  size_ = size;
+  cff2_ = cff2;
+  fds_.clear();
+  fdselect_.clear();
+  regions_.clear();
+  if (size < 5) {
+    return false;
+  }
+
+  uint32_t top_begin = 0;
+  uint32_t top_end = 0;
+  uint32_t gsubrs = 0;
+  const uint8_t header_size = table[2];
+  if (cff2) {
+    top_begin = header_size;
+    top_end = top_begin + read_u16(table + 3);
+    gsubrs = top_end;
+  } else {
+    Index names, tops, strings;
+    if (!readIndex(header_size, names) || !readIndex(names.end, tops) ||
+        !readIndex(tops.end, strings) ||
+        !indexEntry(tops, 0, top_begin, top_end)) {
+      return false;
+    }
+    gsubrs = strings.end;
+  }
+  if (top_end > size_ || !decodeSubrs(gsubrs, gsubrs_)) {
+    return false;
+  }
+
+  uint32_t charstrings = 0;
+  uint32_t private_size = 0;
+  uint32_t private_offset = 0;
+  uint32_t fdarray = 0;
+  uint32_t fdselect = 0;
+  uint32_t vstore = 0;
+  int charstring_type = 2;
+  if (!parse_dict(table + top_begin, table + top_end,
+          [&](uint16_t op, const double* operands, int count) {
+            if (count < 1) {
+              return;
+            }
+            switch (op) {
+              case kDictCharStrings:
+                charstrings = (uint32_t)operands[0];
+                break;
+              case kDictPrivate:
+                if (count >= 2) {
+                  private_size = (uint32_t)operands[0];
+                  private_offset = (uint32_t)operands[1];
+                }
+                break;
+              case kDictFDArray:
+                fdarray = (uint32_t)operands[0];
+                break;
+              case kDictFDSelect:
+                fdselect = (uint32_t)operands[0];
+                break;
+              case kDictVstore:
+                vstore = (uint32_t)operands[0];
+                break;
+              case kDictCharstringType:
+                charstring_type = (int)operands[0];
+                break;
+            }
+          })) {
+    return false;
+  }
+  if (charstring_type != 2 || charstrings == 0 ||
+      !readIndex(charstrings, charstrings_)) {
+    return false;
+  }
+
+  if (fdarray) {
+    Index fonts;
+    if (!readIndex(fdarray, fonts)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < fonts.count; ++i) {
+      uint32_t begin = 0;
+      uint32_t end = 0;
+      if (!indexEntry(fonts, i, begin, end)) {
+        return false;
+      }
+      FontDict fd;
+      uint32_t fd_private_size = 0;
+      uint32_t fd_private_offset = 0;
+      parse_dict(table + begin, table + end,
+          [&](uint16_t op, const double* operands, int count) {
+            if (op == kDictPrivate && count >= 2) {
+              fd_private_size = (uint32_t)operands[0];
+              fd_private_offset = (uint32_t)operands[1];
+            }
+          });
+      if (fd_private_offset &&
+          !loadPrivate(fd_private_offset,
+              fd_private_offset + fd_private_size, fd)) {
+        return false;
+      }
+      fds_.push_back(std::move(fd));
+    }
+    if (fdselect && !loadFDSelect(fdselect, num_glyphs)) {
+      return false;
+    }
+  } else {
+    FontDict fd;
+    if (private_offset &&
+        !loadPrivate(private_offset, private_offset + private_size, fd)) {
+      return false;
+    }
+    fds_.push_back(std::move(fd));
+  }
+  if (fds_.empty()) {
+    return false;
+  }
+  if (vstore) {
+    loadVariationStore(vstore);
+  }
+  return true;
+}
+
+bool CffFont::outline(uint16_t glyph, OutlineSink& sink) const {
+  uint32_t begin = 0;
+  uint32_t end = 0;
+  if (!indexEntry(charstrings_, glyph, begin, end)) {
+    return false;
+  }
+  const size_t fd = glyph < fdselect_.size() ? fdselect_[glyph] : 0;
+  if (fd >= fds_.size()) {
+    return false;
+  }
+  CharstringInterpreter interpreter(*this, fds_[fd], sink);
+  return interpreter.run(begin, end);
+}
+
+}  // namespace simpledwrite
@@ -0,0 +1,60 @@
+#pragma once
+
+// simpledwrite CFF/CFF2 outline reader
+// https://github.com/fecf/simpledwrite
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "simpledwrite_font.h"
+
+namespace simpledwrite {
+
+// Type 2 charstring interpreter over a 'CFF ' or 'CFF2' table. Subroutine
+// INDEXes and FDSelect are decoded once at load time so callsubr/callgsubr
+// and CID font dict selection are plain array lookups.
+class CffFont {
+ public:
+  bool load(const uint8_t* table, size_t size, bool cff2, int num_glyphs);
+  bool outline(uint16_t glyph, OutlineSink& sink) const;
+
+ private:
+  struct Index {
+    uint32_t count = 0;
+    uint32_t offsets = 0;  // position of the offset array
+    uint8_t off_size = 0;
+    uint32_t data = 0;     // position of the byte before the first object
+    uint32_t end = 0;      // position just after the INDEX
+  };
+  // Decoded subroutine INDEX: subr i spans [offsets[i], offsets[i + 1]).
+  struct Subrs {
+    std::vector<uint32_t> offsets;
+    int bias = 0;
+  };
+  struct FontDict {
+    Subrs subrs;
+    int vsindex = 0;
+  };
+
+  bool readIndex(uint32_t pos, Index& index) const;
+  bool indexEntry(const Index& index, uint32_t i, uint32_t& begin,
+      uint32_t& end) const;
+  bool decodeSubrs(uint32_t pos, Subrs& subrs) const;
+  bool loadPrivate(uint32_t begin, uint32_t end, FontDict& dict) const;
+  bool loadFDSelect(uint32_t pos, int num_glyphs);
+  void loadVariationStore(uint32_t pos);
+
+  friend class CharstringInterpreter;
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  bool cff2_ = false;
+  Index charstrings_;
+  Subrs gsubrs_;
+  std::vector<FontDict> fds_;
+  std::vector<uint8_t> fdselect_;    // per glyph, empty unless CID-keyed
+  std::vector<uint16_t> regions_;    // CFF2 region count per vsindex
+};
+
+}  // namespace simpledwrite
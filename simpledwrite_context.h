@@ -0,0 +1,82 @@
+#pragma once
+
+// simpledwrite per-call context pool
+// https://github.com/fecf/simpledwrite
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace simpledwrite {
+
+// Scratch state (render targets, caches, buffers) that one call at a time
+// may use. Concurrent calls each lease their own context, so there are as
+// many as the peak number of calls in flight; they are kept for reuse.
+template <class Context>
+class ContextPool {
+ public:
+  // Returns the context to the pool when destroyed.
+  class Lease {
+   public:
+    Lease(ContextPool* pool, Context* context)
+        : pool_(pool), context_(context) {}
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    ~Lease() { pool_->release(context_); }
+
+    Context& operator*() const { return *context_; }
+    Context* operator->() const { return context_; }
+
+   private:
+    ContextPool* pool_;
+    Context* context_;
+  };
+
+  explicit ContextPool(std::function<std::unique_ptr<Context>()> create)
+      : create_(std::move(create)) {}
+
+  Lease acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!idle_.empty()) {
+        Context* context = idle_.back();
+        idle_.pop_back();
+        return Lease(this, context);
+      }
+    }
+    std::unique_ptr<Context> context = create_();
+    std::lock_guard<std::mutex> lock(mutex_);
+    contexts_.push_back(std::move(context));
+    return Lease(this, contexts_.back().get());
+  }
+
+  // Visits every context. None may be leased meanwhile.
+  template <class Func>
+  void forEach(Func func) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const std::unique_ptr<Context>& context : contexts_) {
+      func(*context);
+    }
+  }
+
+  // Destroys the contexts. None may be leased meanwhile.
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.clear();
+    contexts_.clear();
+  }
+
+ private:
+  void release(Context* context) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(context);
+  }
+
+  std::function<std::unique_ptr<Context>()> create_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Context>> contexts_;
+  std::vector<Context*> idle_;
+};
+
+}  // namespace simpledwrite
@@ -0,0 +1,933 @@
+#include "simpledwrite_font.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+#include "simpledwrite_cff.h"
+
+namespace simpledwrite {
+
+namespace {
+
+bool iequals(const std::string& a, const std::string& b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower((unsigned char)x) ==
+                  std::tolower((unsigned char)y);
+         });
+}
+
+void append_utf8(std::string& out, uint32_t c) {
+  if (c < 0x80) {
+    out.push_back((char)c);
+  } else if (c < 0x800) {
+    out.push_back((char)(0xc0 | (c >> 6)));
+    out.push_back((char)(0x80 | (c & 0x3f)));
+  } else if (c < 0x10000) {
+    out.push_back((char)(0xe0 | (c >> 12)));
+    out.push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+    out.push_back((char)(0x80 | (c & 0x3f)));
+  } else {
+    out.push_back((char)(0xf0 | (c >> 18)));
+    out.push_back((char)(0x80 | ((c >> 12) & 0x3f)));
+    out.push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+    out.push_back((char)(0x80 | (c & 0x3f)));
+  }
+}
+
+// Offset of the table directory of face |index|, or UINT32_MAX.
+uint32_t face_offset(const uint8_t* data, size_t size, uint32_t index) {
+  if (size < 12) {
+    return UINT32_MAX;
+  }
+  if (read_u32(data) == make_tag("ttcf")) {
+    const uint32_t count = read_u32(data + 8);
+    if (index >= count || 12 + 4 * (size_t)(index + 1) > size) {
+      return UINT32_MAX;
+    }
+    return read_u32(data + 12 + 4 * index);
+  }
+  return index == 0 ? 0 : UINT32_MAX;
+}
+
+// Applies a composite glyph component transform before forwarding.
+class TransformSink : public OutlineSink {
+ public:
+  TransformSink(OutlineSink& sink, float a, float b, float c, float d,
+      float e, float f)
+      : sink_(sink), a_(a), b_(b), c_(c), d_(d), e_(e), f_(f) {}
+
+  void moveTo(float x, float y) override { sink_.moveTo(tx(x, y), ty(x, y)); }
+  void lineTo(float x, float y) override { sink_.lineTo(tx(x, y), ty(x, y)); }
+  void quadTo(float cx, float cy, float x, float y) override {
+    sink_.quadTo(tx(cx, cy), ty(cx, cy), tx(x, y), ty(x, y));
+  }
+  void cubicTo(float cx0, float cy0, float cx1, float cy1, float x,
+      float y) override {
+    sink_.cubicTo(tx(cx0, cy0), ty(cx0, cy0), tx(cx1, cy1), ty(cx1, cy1),
+        tx(x, y), ty(x, y));
+  }
+  void close() override { sink_.close(); }
+
+ private:
+  float tx(float x, float y) const { return a_ * x + c_ * y + e_; }
+  float ty(float x, float y) const { return b_ * x + d_ * y + f_; }
+
+  OutlineSink& sink_;
+  float a_, b_, c_, d_, e_, f_;
+};
+
+// Accumulates the control box of an outline.
+class BoundsSink : public OutlineSink {
+ public:
+  explicit BoundsSink(GlyphBounds& bounds) : bounds_(bounds) {}
+
+  void moveTo(float x, float y) override { add(x, y); }
+  void lineTo(float x, float y) override { add(x, y); }
+  void quadTo(float cx, float cy, float x, float y) override {
+    add(cx, cy);
+    add(x, y);
+  }
+  void cubicTo(float cx0, float cy0, float cx1, float cy1, float x,
+      float y) override {
+    add(cx0, cy0);
+    add(cx1, cy1);
+    add(x, y);
+  }
+  void close() override {}
+
+ private:
+  void add(float x, float y) {
+    if (first_) {
+      bounds_.x_min = bounds_.x_max = x;
+      bounds_.y_min = bounds_.y_max = y;
+      first_ = false;
+      return;
+    }
+    bounds_.x_min = std::min(bounds_.x_min, x);
+    bounds_.y_min = std::min(bounds_.y_min, y);
+    bounds_.x_max = std::max(bounds_.x_max, x);
+    bounds_.y_max = std::max(bounds_.y_max, y);
+  }
+
+  GlyphBounds& bounds_;
+  bool first_ = true;
+};
+
+}  // namespace
+
+bool FaceStyle::hasFamily(const std::string& family) const {
+  for (const std::string& name : families) {
+    if (iequals(name, family)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void parse_face_style(const uint8_t* name, size_t name_size,
+    const uint8_t* os2, size_t os2_size, FaceStyle& style) {
+  if (name != nullptr && name_size >= 6) {
+    const uint16_t count = read_u16(name + 2);
+    const uint16_t storage = read_u16(name + 4);
+    for (uint16_t i = 0; i < count && 6 + 12 * (size_t)(i + 1) <= name_size;
+         ++i) {
+      const uint8_t* rec = name + 6 + 12 * i;
+      const uint16_t platform = read_u16(rec);
+      const uint16_t encoding = read_u16(rec + 2);
+      const uint16_t name_id = read_u16(rec + 6);
+      const uint16_t length = read_u16(rec + 8);
+      const size_t offset = (size_t)storage + read_u16(rec + 10);
+      if ((name_id != 1 && name_id != 16) || offset + length > name_size) {
+        continue;
+      }
+      const uint8_t* str = name + offset;
+      std::string family;
+      if (platform == 0 || platform == 3) {
+        for (size_t j = 0; j + 1 < length; j += 2) {
+          uint32_t c = read_u16(str + j);
+          if (c >= 0xd800 && c < 0xdc00 && j + 3 < length) {
+            const uint32_t lo = read_u16(str + j + 2);
+            c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+            j += 2;
+          }
+          append_utf8(family, c);
+        }
+      } else if (platform == 1 && encoding == 0) {
+        for (size_t j = 0; j < length; ++j) {
+          append_utf8(family, str[j] < 0x80 ? str[j] : '?');
+        }
+      } else {
+        continue;
+      }
+      if (!family.empty() && !style.hasFamily(family)) {
+        style.families.push_back(family);
+      }
+    }
+  }
+  if (os2 != nullptr && os2_size >= 64) {
+    style.weight = read_u16(os2 + 4);
+    style.stretch = read_u16(os2 + 6);
+    style.italic = (read_u16(os2 + 62) & 0x0201) != 0;  // ITALIC | OBLIQUE
+  }
+}
+
+FontFace::FontFace() = default;
+
+FontFace::~FontFace() = default;
+
+uint32_t FontFace::countFaces(const uint8_t* data, size_t size) {
+  if (size < 12) {
+    return 0;
+  }
+  if (read_u32(data) == make_tag("ttcf")) {
+    // The count is untrusted; the offset table must fit in the file.
+    return (uint32_t)std::min<size_t>(read_u32(data + 8), (size - 12) / 4);
+  }
+  return 1;
+}
+
+bool FontFace::load(const uint8_t* data, size_t size, uint32_t index) {
+  data_ = data;
+  size_ = size;
+  dir_offset_ = face_offset(data, size, index);
+  if (dir_offset_ == UINT32_MAX || (size_t)dir_offset_ + 12 > size) {
+    return false;
+  }
+
+  const Table head = findTable("head");
+  const Table hhea = findTable("hhea");
+  const Table maxp = findTable("maxp");
+  hmtx_ = findTable("hmtx");
+  cmap_ = findTable("cmap");
+  loca_ = findTable("loca");
+  glyf_ = findTable("glyf");
+  cff_.reset();
+  if (head.length < 54 || hhea.length < 36 || maxp.length < 6) {
+    return false;
+  }
+
+  units_per_em_ = read_u16(data_ + head.offset + 18);
+  long_loca_ = read_i16(data_ + head.offset + 50) != 0;
+  if (units_per_em_ == 0) {
+    units_per_em_ = 1000;
+  }
+  num_glyphs_ = read_u16(data_ + maxp.offset + 4);
+  ascent_ = read_i16(data_ + hhea.offset + 4);
+  descent_ = -read_i16(data_ + hhea.offset + 6);
+  line_gap_ = read_i16(data_ + hhea.offset + 8);
+  num_hmetrics_ = read_u16(data_ + hhea.offset + 34);
+  if ((size_t)num_hmetrics_ * 4 > hmtx_.length) {
+    num_hmetrics_ = (int)(hmtx_.length / 4);
+  }
+
+  const Table name = findTable("name");
+  const Table os2 = findTable("OS/2");
+  style_ = FaceStyle();
+  parse_face_style(name.length ? data_ + name.offset : nullptr, name.length,
+      os2.length ? data_ + os2.offset : nullptr, os2.length, style_);
+  if (os2.length >= 78) {
+    const uint8_t* p = data_ + os2.offset;
+    const bool use_typo = (read_u16(p + 62) & 0x80) != 0;
+    if (use_typo) {
+      ascent_ = read_i16(p + 68);
+      descent_ = -read_i16(p + 70);
+      line_gap_ = read_i16(p + 72);
+    } else if (ascent_ == 0 && descent_ == 0) {
+      ascent_ = read_u16(p + 74);
+      descent_ = read_u16(p + 76);
+    }
+  }
+
+  if (glyf_.length == 0) {
+    const Table cff = findTable("CFF ");
+    const Table cff2 = findTable("CFF2");
+    const Table& table = cff.length ? cff : cff2;
+    if (table.length) {
+      cff_ = std::make_unique<CffFont>();
+      if (!cff_->load(data_ + table.offset, table.length, cff.length == 0,
+              num_glyphs_)) {
+        cff_.reset();
+      }
+    }
+  }
+
+  loadCmap();
+  return true;
+}
+
+FontFace::Table FontFace::findTable(const char* tag) const {
+  const uint32_t want = make_tag(tag);
+  const uint16_t count = read_u16(data_ + dir_offset_ + 4);
+  for (uint16_t i = 0; i < count; ++i) {
+    const size_t rec = (size_t)dir_offset_ + 12 + 16 * (size_t)i;
+    if (rec + 16 > size_) {
+      break;
+    }
+    if (read_u32(data_ + rec) != want) {
+      continue;
+    }
+    Table table;
+    table.offset = read_u32(data_ + rec + 8);
+    table.length = read_u32(data_ + rec + 12);
+    if ((size_t)table.offset + table.length > size_) {
+      return Table();
+    }
+    return table;
+  }
+  return Table();
+}
+
+void CmapTable::clear() {
+  pages_.clear();
+  blocks_.assign(256, 0);
+}
+
+void CmapTable::set(uint32_t codepoint, uint16_t glyph) {
+  if (codepoint > 0x10ffff || glyph == 0) {
+    return;
+  }
+  if (blocks_.empty()) {
+    blocks_.assign(256, 0);
+  }
+  const uint32_t page = codepoint >> 8;
+  if (page >= pages_.size()) {
+    pages_.resize(page + 1, 0);
+  }
+  if (pages_[page] == 0) {
+    pages_[page] = (uint16_t)(blocks_.size() >> 8);
+    blocks_.resize(blocks_.size() + 256, 0);
+  }
+  blocks_[((size_t)pages_[page] << 8) | (codepoint & 0xff)] = glyph;
+}
+
+size_t CmapTable::memoryUsage() const {
+  return pages_.capacity() * sizeof(uint16_t) +
+         blocks_.capacity() * sizeof(uint16_t);
+}
+
+void FontFace::loadCmap() {
+  cmap_table_.clear();
+  variations_.clear();
+  if (cmap_.length < 4) {
+    return;
+  }
+  const uint8_t* cmap = data_ + cmap_.offset;
+  const uint16_t count = read_u16(cmap + 2);
+  int best = -1;
+  uint32_t best_offset = 0;
+  uint16_t best_format = 0;
+  for (uint16_t i = 0; i < count && 4 + 8 * (size_t)(i + 1) <= cmap_.length;
+       ++i) {
+    const uint16_t platform = read_u16(cmap + 4 + 8 * i);
+    const uint16_t encoding = read_u16(cmap + 4 + 8 * i + 2);
+    const uint32_t offset = read_u32(cmap + 4 + 8 * i + 4);
+    if ((size_t)offset + 4 > cmap_.length) {
+      continue;
+    }
+    const uint16_t format = read_u16(cmap + offset);
+    if (format == 14 && platform == 0 && encoding == 5) {
+      loadVariationSequences(cmap_.offset + offset);
+      continue;
+    }
+    if (format != 0 && format != 4 && format != 6 && format != 12 &&
+        format != 13) {
+      continue;
+    }
+    // Prefer full Unicode repertoire, then BMP, then symbol.
+    int score = 0;
+    if ((platform == 3 && encoding == 10) || (platform == 0 && encoding >= 4)) {
+      score = 4;
+    } else if ((platform == 3 && encoding == 1) || platform == 0) {
+      score = 3;
+    } else if (platform == 3 && encoding == 0) {
+      score = 2;
+    } else {
+      score = 1;
+    }
+    if (score > best) {
+      best = score;
+      best_offset = cmap_.offset + offset;
+      best_format = format;
+    }
+  }
+  if (best >= 0) {
+    loadCmapSubtable(best_offset, best_format);
+  }
+}
+
+void FontFace::loadCmapSubtable(uint32_t offset, uint16_t format) {
+  const uint8_t* sub = data_ + offset;
+  const size_t avail = size_ - offset;
+  switch (format) {
+    case 0: {
+      if (6 + 256 > avail) {
+        return;
+      }
+      for (uint32_t c = 0; c < 256; ++c) {
+        cmap_table_.set(c, sub[6 + c]);
+      }
+      return;
+    }
+    case 4: {
+      if (avail < 14) {
+        return;
+      }
+      const uint16_t segcount = read_u16(sub + 6) / 2;
+      if (16 + 8 * (size_t)segcount > avail) {
+        return;
+      }
+      const uint8_t* ends = sub + 14;
+      const uint8_t* starts = ends + 2 * segcount + 2;
+      const uint8_t* deltas = starts + 2 * segcount;
+      const uint8_t* ranges = deltas + 2 * segcount;
+      for (uint16_t seg = 0; seg < segcount; ++seg) {
+        const uint32_t start = read_u16(starts + 2 * seg);
+        const uint32_t end = read_u16(ends + 2 * seg);
+        const uint16_t delta = read_u16(deltas + 2 * seg);
+        const uint16_t range = read_u16(ranges + 2 * seg);
+        for (uint32_t c = start; c <= end && c < 0xffff; ++c) {
+          if (range == 0) {
+            cmap_table_.set(c, (uint16_t)(c + delta));
+            continue;
+          }
+          const size_t pos = (size_t)(ranges + 2 * seg - sub) + range +
+                             2 * (size_t)(c - start);
+          if (pos + 2 > avail) {
+            break;
+          }
+          const uint16_t glyph = read_u16(sub + pos);
+          if (glyph) {
+            cmap_table_.set(c, (uint16_t)(glyph + delta));
+          }
+        }
+      }
+      return;
+    }
+    case 6: {
+      if (avail < 10) {
+        return;
+      }
+      const uint16_t first = read_u16(sub + 6);
+      const uint16_t count = read_u16(sub + 8);
+      for (uint32_t i = 0; i < count && 10 + 2 * (size_t)(i + 1) <= avail;
+           ++i) {
+        cmap_table_.set(first + i, read_u16(sub + 10 + 2 * i));
+      }
+      return;
+    }
+    case 12:
+    case 13: {
+      if (avail < 16) {
+        return;
+      }
+      const uint32_t count = read_u32(sub + 12);
+      if (16 + 12 * (size_t)count > avail) {
+        return;
+      }
+      // Groups must be sorted and disjoint, which bounds the work by the
+      // codepoint space; the first one that is not ends the table.
+      uint32_t next = 0;
+      for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t* group = sub + 16 + 12 * i;
+        const uint32_t start = read_u32(group);
+        const uint32_t end = read_u32(group + 4);
+        const uint32_t glyph = read_u32(group + 8);
+        if (start < next || start > end || start > 0x10ffff) {
+          return;
+        }
+        next = std::min(end, 0x10ffffu) + 1;
+        for (uint32_t c = start; c < next; ++c) {
+          const uint64_t id = format == 12 ? (uint64_t)glyph + (c - start)
+                                           : glyph;
+          if (id >= (uint64_t)num_glyphs_) {
+            break;
+          }
+          cmap_table_.set(c, (uint16_t)id);
+        }
+      }
+      return;
+    }
+  }
+}
+
+void FontFace::loadVariationSequences(uint32_t offset) {
+  const uint8_t* sub = data_ + offset;
+  const size_t avail = size_ - offset;
+  if (avail < 10) {
+    return;
+  }
+  const uint32_t count = read_u32(sub + 6);
+  if (10 + 11 * (size_t)count > avail) {
+    return;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint8_t* rec = sub + 10 + 11 * i;
+    const uint32_t selector = (rec[0] << 16) | (rec[1] << 8) | rec[2];
+    const uint32_t nondefault = read_u32(rec + 7);
+    if (nondefault == 0 || (size_t)nondefault + 4 > avail) {
+      continue;
+    }
+    const uint32_t mappings = read_u32(sub + nondefault);
+    if ((size_t)nondefault + 4 + 5 * (size_t)mappings > avail) {
+      continue;
+    }
+    for (uint32_t j = 0; j < mappings; ++j) {
+      const uint8_t* m = sub + nondefault + 4 + 5 * j;
+      VariationSequence vs;
+      vs.codepoint = (m[0] << 16) | (m[1] << 8) | m[2];
+      vs.selector = selector;
+      vs.glyph = read_u16(m + 3);
+      variations_.push_back(vs);
+    }
+  }
+  std::sort(variations_.begin(), variations_.end(),
+      [](const VariationSequence& a, const VariationSequence& b) {
+        return a.codepoint != b.codepoint ? a.codepoint < b.codepoint
+                                          : a.selector < b.selector;
+      });
+}
+
+uint16_t FontFace::variantGlyphIndex(
+    uint32_t codepoint, uint32_t selector) const {
+  auto it = std::lower_bound(variations_.begin(), variations_.end(),
+      std::make_pair(codepoint, selector),
+      [](const VariationSequence& vs, const std::pair<uint32_t, uint32_t>& key) {
+        return vs.codepoint != key.first ? vs.codepoint < key.first
+                                         : vs.selector < key.second;
+      });
+  if (it != variations_.end() && it->codepoint == codepoint &&
+      it->selector == selector) {
+    return it->glyph;
+  }
+  return 0;
+}
+
+size_t FontFace::cmapMemoryUsage() const {
+  return cmap_table_.memoryUsage() +
+         variations_.capacity() * sizeof(VariationSequence);
+}
+
+int FontFace::advanceWidth(uint16_t glyph) const {
+  if (num_hmetrics_ == 0) {
+    return 0;
+  }
+  const int index = std::min((int)glyph, num_hmetrics_ - 1);
+  return read_u16(data_ + hmtx_.offset + 4 * index);
+}
+
+bool FontFace::outline(uint16_t glyph, OutlineSink& sink) const {
+  if (glyf_.length) {
+    return glyfOutline(glyph, sink, 0);
+  }
+  if (cff_) {
+    return cff_->outline(glyph, sink);
+  }
+  return false;
+}
+
+bool FontFace::glyphBounds(uint16_t glyph, GlyphBounds& bounds) const {
+  bounds = GlyphBounds();
+  if (glyf_.length) {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    if (!glyfRange(glyph, offset, length)) {
+      return false;
+    }
+    if (length >= 10) {
+      const uint8_t* p = data_ + glyf_.offset + offset;
+      bounds.x_min = read_i16(p + 2);
+      bounds.y_min = read_i16(p + 4);
+      bounds.x_max = read_i16(p + 6);
+      bounds.y_max = read_i16(p + 8);
+    }
+    return true;
+  }
+  if (cff_) {
+    BoundsSink sink(bounds);
+    return cff_->outline(glyph, sink);
+  }
+  return false;
+}
+
+bool FontFace::glyfRange(
+    uint16_t glyph, uint32_t& offset, uint32_t& length) const {
+  if (glyph >= num_glyphs_) {
+    return false;
+  }
+  const uint8_t* loca = data_ + loca_.offset;
+  uint32_t begin = 0;
+  uint32_t end = 0;
+  if (long_loca_) {
+    if (4 * ((size_t)glyph + 2) > loca_.length) {
+      return false;
+    }
+    begin = read_u32(loca + 4 * glyph);
+    end = read_u32(loca + 4 * glyph + 4);
+  } else {
+    if (2 * ((size_t)glyph + 2) > loca_.length) {
+      return false;
+    }
+    begin = read_u16(loca + 2 * glyph) * 2u;
+    end = read_u16(loca + 2 * glyph + 2) * 2u;
+  }
+  if (begin > end || end > glyf_.length) {
+    return false;
+  }
+  offset = begin;
+  length = end - begin;
+  return true;
+}
+
+bool FontFace::glyfOutline(
+    uint16_t glyph, OutlineSink& sink, int depth) const {
+  uint32_t offset = 0;
+  uint32_t length = 0;
+  if (depth > 8 || !glyfRange(glyph, offset, length)) {
+    return false;
+  }
+  if (length == 0) {
+    return true;
+  }
+  if (length < 10) {
+    return false;
+  }
+  const uint8_t* begin = data_ + glyf_.offset + offset;
+  const uint8_t* end = begin + length;
+  const int16_t contours = read_i16(begin);
+
+  if (contours < 0) {
+    // Composite glyph
+    enum {
+      ARG_1_AND_2_ARE_WORDS = 0x0001,
+      ARGS_ARE_XY_VALUES = 0x0002,
+      WE_HAVE_A_SCALE = 0x0008,
+      MORE_COMPONENTS = 0x0020,
+      WE_HAVE_AN_X_AND_Y_SCALE = 0x0040,
+      WE_HAVE_A_TWO_BY_TWO = 0x0080,
+    };
+    const uint8_t* p = begin + 10;
+    uint16_t flags = MORE_COMPONENTS;
+    while (flags & MORE_COMPONENTS) {
+      if (p + 4 > end) {
+        return false;
+      }
+      flags = read_u16(p);
+      const uint16_t component = read_u16(p + 2);
+      p += 4;
+      float e = 0.0f;
+      float f = 0.0f;
+      if (flags & ARG_1_AND_2_ARE_WORDS) {
+        if (p + 4 > end) {
+          return false;
+        }
+        e = read_i16(p);
+        f = read_i16(p + 2);
+        p += 4;
+      } else {
+        if (p + 2 > end) {
+          return false;
+        }
+        e = (int8_t)p[0];
+        f = (int8_t)p[1];
+        p += 2;
+      }
+      if (!(flags & ARGS_ARE_XY_VALUES)) {
+        // Point matching is rare enough to ignore.
+        e = 0.0f;
+        f = 0.0f;
+      }
+      float a = 1.0f, b = 0.0f, c = 0.0f, d = 1.0f;
+      if (flags & WE_HAVE_A_SCALE) {
+        if (p + 2 > end) {
+          return false;
+        }
+        a = d = read_i16(p) / 16384.0f;
+        p += 2;
+      } else if (flags & WE_HAVE_AN_X_AND_Y_SCALE) {
+        if (p + 4 > end) {
+          return false;
+        }
+        a = read_i16(p) / 16384.0f;
+        d = read_i16(p + 2) / 16384.0f;
+        p += 4;
+      } else if (flags & WE_HAVE_A_TWO_BY_TWO) {
+        if (p + 8 > end) {
+          return false;
+        }
+        a = read_i16(p) / 16384.0f;
+        b = read_i16(p + 2) / 16384.0f;
+        c = read_i16(p + 4) / 16384.0f;
+        d = read_i16(p + 6) / 16384.0f;
+        p += 8;
+      }
+      TransformSink transformed(sink, a, b, c, d, e, f);
+      if (!glyfOutline(component, transformed, depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Simple glyph
+  const uint8_t* p = begin + 10;
+  if (p + 2 * (size_t)contours + 2 > end) {
+    return false;
+  }
+  const uint8_t* end_points = p;
+  const int points = contours ? read_u16(p + 2 * (contours - 1)) + 1 : 0;
+  p += 2 * contours;
+  p += 2 + read_u16(p);
+  if (p > end) {
+    return false;
+  }
+
+  enum {
+    ON_CURVE = 0x01,
+    X_SHORT = 0x02,
+    Y_SHORT = 0x04,
+    REPEAT = 0x08,
+    X_SAME_OR_POSITIVE = 0x10,
+    Y_SAME_OR_POSITIVE = 0x20,
+  };
+  thread_local std::vector<uint8_t> flags;
+  thread_local std::vector<float> xs;
+  thread_local std::vector<float> ys;
+  flags.resize(points);
+  xs.resize(points);
+  ys.resize(points);
+  for (int i = 0; i < points;) {
+    if (p >= end) {
+      return false;
+    }
+    const uint8_t flag = *p++;
+    int repeat = 1;
+    if (flag & REPEAT) {
+      if (p >= end) {
+        return false;
+      }
+      repeat += *p++;
+    }
+    for (; repeat > 0 && i < points; --repeat) {
+      flags[i++] = flag;
+    }
+  }
+  auto read_coords = [&](std::vector<float>& out, uint8_t short_flag,
+                         uint8_t same_flag) {
+    int value = 0;
+    for (int i = 0; i < points; ++i) {
+      const uint8_t flag = flags[i];
+      if (flag & short_flag) {
+        if (p >= end) {
+          return false;
+        }
+        value += (flag & same_flag) ? *p : -(int)*p;
+        ++p;
+      } else if (!(flag & same_flag)) {
+        if (p + 2 > end) {
+          return false;
+        }
+        value += read_i16(p);
+        p += 2;
+      }
+      out[i] = (float)value;
+    }
+    return true;
+  };
+  if (!read_coords(xs, X_SHORT, X_SAME_OR_POSITIVE) ||
+      !read_coords(ys, Y_SHORT, Y_SAME_OR_POSITIVE)) {
+    return false;
+  }
+
+  int start = 0;
+  for (int c = 0; c < contours; ++c) {
+    const int last = read_u16(end_points + 2 * c);
+    if (last < start || last >= points) {
+      return false;
+    }
+    const int n = last - start + 1;
+    auto on = [&](int i) { return (flags[start + i] & ON_CURVE) != 0; };
+    auto x = [&](int i) { return xs[start + i]; };
+    auto y = [&](int i) { return ys[start + i]; };
+    if (n < 2) {
+      start = last + 1;
+      continue;
+    }
+
+    // Start on an on-curve point, or on the implied midpoint of two
+    // off-curve points.
+    float sx, sy;
+    int first, count;
+    if (on(0)) {
+      sx = x(0), sy = y(0), first = 1, count = n - 1;
+    } else if (on(n - 1)) {
+      sx = x(n - 1), sy = y(n - 1), first = 0, count = n - 1;
+    } else {
+      sx = (x(0) + x(n - 1)) * 0.5f, sy = (y(0) + y(n - 1)) * 0.5f;
+      first = 0, count = n;
+    }
+    sink.moveTo(sx, sy);
+    bool has_control = false;
+    float cx = 0.0f, cy = 0.0f;
+    for (int k = 0; k < count; ++k) {
+      const int i = first + k;
+      if (on(i)) {
+        if (has_control) {
+          sink.quadTo(cx, cy, x(i), y(i));
+        } else {
+          sink.lineTo(x(i), y(i));
+        }
+        has_control = false;
+      } else {
+        if (has_control) {
+          sink.quadTo(cx, cy, (cx + x(i)) * 0.5f, (cy + y(i)) * 0.5f);
+        }
+        cx = x(i), cy = y(i);
+        has_control = true;
+      }
+    }
+    if (has_control) {
+      sink.quadTo(cx, cy, sx, sy);
+    } else {
+      sink.lineTo(sx, sy);
+    }
+    sink.close();
+    start = last + 1;
+  }
+  return true;
+}
+
+bool read_file(const std::string& path, std::vector<uint8_t>& out) {
+  std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+  if (!ifs) {
+    return false;
+  }
+  const std::streamoff size = ifs.tellg();
+  if (size <= 0) {
+    return false;
+  }
+  out.resize((size_t)size);
+  ifs.seekg(0);
+  return (bool)ifs.read((char*)out.data(), size);
+}
+
+static bool read_range(
+    std::ifstream& ifs, uint32_t offset, uint32_t length, std::vector<uint8_t>& out) {
+  out.resize(length);
+  ifs.clear();
+  ifs.seekg(offset);
+  return length == 0 || (bool)ifs.read((char*)out.data(), length);
+}
+
+static void scan_font_file(
+    const std::string& path, std::vector<SystemFontFile>& out) {
+  std::ifstream ifs(path, std::ios::binary);
+  std::vector<uint8_t> header;
+  if (!read_range(ifs, 0, 12, header)) {
+    return;
+  }
+  std::vector<uint32_t> offsets;
+  if (read_u32(header.data()) == make_tag("ttcf")) {
+    const uint32_t count = std::min(read_u32(header.data() + 8), 256u);
+    std::vector<uint8_t> table;
+    if (!read_range(ifs, 12, 4 * count, table)) {
+      return;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      offsets.push_back(read_u32(table.data() + 4 * i));
+    }
+  } else {
+    offsets.push_back(0);
+  }
+
+  for (uint32_t index = 0; index < (uint32_t)offsets.size(); ++index) {
+    std::vector<uint8_t> dir;
+    if (!read_range(ifs, offsets[index], 12, dir)) {
+      continue;
+    }
+    const uint16_t count = read_u16(dir.data() + 4);
+    if (!read_range(ifs, offsets[index] + 12, 16 * count, dir)) {
+      continue;
+    }
+    std::vector<uint8_t> name;
+    std::vector<uint8_t> os2;
+    for (uint16_t i = 0; i < count; ++i) {
+      const uint8_t* rec = dir.data() + 16 * i;
+      const uint32_t tag = read_u32(rec);
+      if (tag == make_tag("name")) {
+        read_range(ifs, read_u32(rec + 8), read_u32(rec + 12), name);
+      } else if (tag == make_tag("OS/2")) {
+        read_range(ifs, read_u32(rec + 8), read_u32(rec + 12), os2);
+      }
+    }
+    SystemFontFile file;
+    file.path = path;
+    file.index = index;
+    parse_face_style(name.data(), name.size(), os2.data(), os2.size(),
+        file.style);
+    if (!file.style.families.empty()) {
+      out.push_back(std::move(file));
+    }
+  }
+}
+
+const std::vector<SystemFontFile>& scan_system_fonts() {
+  static std::vector<SystemFontFile> files;
+  static std::once_flag once;
+  std::call_once(once, [&] {
+    std::vector<std::filesystem::path> dirs;
+    auto env = [](const char* name) -> std::string {
+      const char* value = std::getenv(name);
+      return value ? value : "";
+    };
+#if defined(_WIN32)
+    if (!env("WINDIR").empty()) {
+      dirs.push_back(std::filesystem::path(env("WINDIR")) / "Fonts");
+    }
+    if (!env("LOCALAPPDATA").empty()) {
+      dirs.push_back(std::filesystem::path(env("LOCALAPPDATA")) /
+                     "Microsoft" / "Windows" / "Fonts");
+    }
+#elif defined(__APPLE__)
+    dirs.push_back("/System/Library/Fonts");
+    dirs.push_back("/Library/Fonts");
+    if (!env("HOME").empty()) {
+      dirs.push_back(std::filesystem::path(env("HOME")) / "Library" / "Fonts");
+    }
+#else
+    if (!env("XDG_DATA_HOME").empty()) {
+      dirs.push_back(std::filesystem::path(env("XDG_DATA_HOME")) / "fonts");
+    }
+    if (!env("HOME").empty()) {
+      dirs.push_back(std::filesystem::path(env("HOME")) / ".local" / "share" / "fonts");
+      dirs.push_back(std::filesystem::path(env("HOME")) / ".fonts");
+    }
+    dirs.push_back("/usr/local/share/fonts");
+    dirs.push_back("/usr/share/fonts");
+#endif
+    for (const std::filesystem::path& dir : dirs) {
+      std::error_code ec;
+      std::filesystem::recursive_directory_iterator it(dir,
+          std::filesystem::directory_options::skip_permission_denied, ec);
+      for (; !ec && it != std::filesystem::recursive_directory_iterator();
+           it.increment(ec)) {
+        if (!it->is_regular_file(ec)) {
+          continue;
+        }
+        std::string ext = it->path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(),
+            [](unsigned char c) { return (char)std::tolower(c); });
+        if (ext == ".ttf" || ext == ".otf" || ext == ".ttc" || ext == ".otc") {
+          scan_font_file(it->path().string(), files);
+        }
+      }
+    }
+  });
+  return files;
+}
+
+}  // namespace simpledwrite
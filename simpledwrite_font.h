@@ -0,0 +1,177 @@
+#pragma once
+
+// simpledwrite sfnt (TrueType/OpenType) reader
+// https://github.com/fecf/simpledwrite
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace simpledwrite {
+
+inline uint16_t read_u16(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+inline int16_t read_i16(const uint8_t* p) { return (int16_t)read_u16(p); }
+inline uint32_t read_u32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+inline uint32_t make_tag(const char* s) {
+  return ((uint32_t)s[0] << 24) | ((uint32_t)s[1] << 16) |
+         ((uint32_t)s[2] << 8) | (uint32_t)s[3];
+}
+
+// Receives glyph outlines in font units, y up. Contours are always closed
+// with close() before the next moveTo().
+class OutlineSink {
+ public:
+  virtual ~OutlineSink() = default;
+  virtual void moveTo(float x, float y) = 0;
+  virtual void lineTo(float x, float y) = 0;
+  virtual void quadTo(float cx, float cy, float x, float y) = 0;
+  virtual void cubicTo(
+      float cx0, float cy0, float cx1, float cy1, float x, float y) = 0;
+  virtual void close() = 0;
+};
+
+// Glyph ink box in font units, y up.
+struct GlyphBounds {
+  float x_min = 0.0f;
+  float y_min = 0.0f;
+  float x_max = 0.0f;
+  float y_max = 0.0f;
+
+  bool empty() const { return x_min >= x_max || y_min >= y_max; }
+};
+
+// Family names and style attributes of a face, as used for font matching.
+struct FaceStyle {
+  std::vector<std::string> families;  // name ID 1 and 16, utf-8
+  int weight = 400;                   // OS/2 usWeightClass
+  int stretch = 5;                    // OS/2 usWidthClass
+  bool italic = false;
+
+  bool hasFamily(const std::string& family) const;
+};
+
+class CffFont;
+
+// Two-level codepoint -> glyph table: the high bits of a codepoint select a
+// 256-entry block, the low byte indexes into it. Block 0 is the shared empty
+// block, so unmapped pages cost two bytes each.
+class CmapTable {
+ public:
+  void clear();
+  void set(uint32_t codepoint, uint16_t glyph);
+  uint16_t lookup(uint32_t codepoint) const {
+    const uint32_t page = codepoint >> 8;
+    if (page >= pages_.size()) {
+      return 0;
+    }
+    return blocks_[((size_t)pages_[page] << 8) | (codepoint & 0xff)];
+  }
+  size_t memoryUsage() const;
+
+ private:
+  std::vector<uint16_t> pages_;
+  std::vector<uint16_t> blocks_;
+};
+
+// Read-only view over one face of an sfnt file. The bytes are owned by the
+// caller and must outlive the face.
+class FontFace {
+ public:
+  struct Table {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+  };
+
+  FontFace();
+  ~FontFace();
+  FontFace(const FontFace&) = delete;
+  FontFace& operator=(const FontFace&) = delete;
+
+  static uint32_t countFaces(const uint8_t* data, size_t size);
+
+  // Returns false if the data is not a usable sfnt face.
+  bool load(const uint8_t* data, size_t size, uint32_t index = 0);
+
+  uint16_t glyphIndex(uint32_t codepoint) const {
+    return cmap_table_.lookup(codepoint);
+  }
+  // Glyph for |codepoint| followed by variation selector |selector|
+  // (cmap format 14), or 0 if the sequence uses the default glyph.
+  uint16_t variantGlyphIndex(uint32_t codepoint, uint32_t selector) const;
+  // Bytes held by the codepoint lookup tables.
+  size_t cmapMemoryUsage() const;
+  int advanceWidth(uint16_t glyph) const;  // font units
+
+  // Emits the outline of |glyph|. Returns false if the face has no
+  // supported outline table or the glyph data is malformed.
+  bool outline(uint16_t glyph, OutlineSink& sink) const;
+  bool glyphBounds(uint16_t glyph, GlyphBounds& bounds) const;
+  bool hasOutlines() const { return glyf_.length != 0 || cff_ != nullptr; }
+
+  const FaceStyle& style() const { return style_; }
+  int unitsPerEm() const { return units_per_em_; }
+  int ascent() const { return ascent_; }    // font units, positive up
+  int descent() const { return descent_; }  // font units, positive down
+  int lineGap() const { return line_gap_; }
+  int numGlyphs() const { return num_glyphs_; }
+
+ private:
+  Table findTable(const char* tag) const;
+  void loadCmap();
+  void loadCmapSubtable(uint32_t offset, uint16_t format);
+  void loadVariationSequences(uint32_t offset);
+  bool glyfRange(uint16_t glyph, uint32_t& offset, uint32_t& length) const;
+  bool glyfOutline(uint16_t glyph, OutlineSink& sink, int depth) const;
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  uint32_t dir_offset_ = 0;
+
+  Table hmtx_;
+  Table cmap_;
+  Table loca_;
+  Table glyf_;
+  bool long_loca_ = false;
+  std::unique_ptr<CffFont> cff_;  // 'CFF ' or 'CFF2' outlines
+  CmapTable cmap_table_;
+  struct VariationSequence {
+    uint32_t codepoint;
+    uint32_t selector;
+    uint16_t glyph;
+  };
+  std::vector<VariationSequence> variations_;  // sorted, non-default only
+
+  FaceStyle style_;
+  int units_per_em_ = 1000;
+  int ascent_ = 0;
+  int descent_ = 0;
+  int line_gap_ = 0;
+  int num_glyphs_ = 0;
+  int num_hmetrics_ = 0;
+};
+
+// Parses the 'name' and 'OS/2' tables into |style|. Either may be empty.
+void parse_face_style(const uint8_t* name, size_t name_size,
+    const uint8_t* os2, size_t os2_size, FaceStyle& style);
+
+// Font file on disk, as found by scan_system_fonts().
+struct SystemFontFile {
+  std::string path;
+  uint32_t index = 0;
+  FaceStyle style;
+};
+
+// Enumerates the platform font directories once and caches the result.
+// Only the table directory, 'name' and 'OS/2' of each file are read.
+const std::vector<SystemFontFile>& scan_system_fonts();
+
+bool read_file(const std::string& path, std::vector<uint8_t>& out);
+
+}  // namespace simpledwrite
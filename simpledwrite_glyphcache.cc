@@ -0,0 +1,40 @@
+#include "simpledwrite_glyphcache.h"
+
+#include <cstring>
+#include <functional>
+
+namespace simpledwrite {
+
+size_t GlyphKeyHash::operator()(const GlyphKey& key) const {
+  uint32_t size_bits;
+  uint32_t outline_bits;
+  std::memcpy(&size_bits, &key.size, sizeof(size_bits));
+  std::memcpy(&outline_bits, &key.outline_width, sizeof(outline_bits));
+  size_t h = std::hash<const void*>()(key.face);
+  auto mix = [&h](uint64_t v) {
+    h ^= (size_t)v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+  };
+  mix((uint64_t)key.glyph | (uint64_t)key.phase_x << 16 |
+      (uint64_t)key.phase_y << 24 | (uint64_t)key.aliased << 32);
+  mix((uint64_t)size_bits << 32 | outline_bits);
+  return h;
+}
+
+size_t GlyphMaskWeight::operator()(const GlyphMask& mask) const {
+  // Capacity, not size: the buffers of evicted masks are reused.
+  return mask.coverage.capacity() + sizeof(GlyphKey) + sizeof(GlyphMask) +
+         6 * sizeof(void*);
+}
+
+GlyphCacheStats GlyphCache::stats() const {
+  GlyphCacheStats stats;
+  stats.entries = cache_.size();
+  stats.bytes = cache_.weight();
+  stats.budget = cache_.capacity();
+  stats.hits = cache_.hits();
+  stats.misses = cache_.misses();
+  stats.evictions = cache_.evictions();
+  return stats;
+}
+
+}  // namespace simpledwrite
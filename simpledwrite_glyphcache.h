@@ -0,0 +1,76 @@
+#pragma once
+
+// simpledwrite glyph coverage cache
+// https://github.com/fecf/simpledwrite
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "simpledwrite.h"
+#include "simpledwrite_lru.h"
+#include "simpledwrite_raster.h"
+
+namespace simpledwrite {
+
+constexpr size_t kDefaultGlyphCacheBudget = 4 * 1024 * 1024;
+
+// Glyph origins are snapped to 1/kSubpixelPhases of a pixel on both axes so
+// that a cached mask can be reused at any position with the same phase.
+constexpr int kSubpixelPhases = 4;
+
+struct GlyphKey {
+  const void* face = nullptr;
+  uint16_t glyph = 0;
+  uint8_t phase_x = 0;
+  uint8_t phase_y = 0;
+  bool aliased = false;
+  float size = 0.0f;           // em, pixels
+  float outline_width = 0.0f;  // pixels, 0 = fill coverage
+
+  bool operator==(const GlyphKey& other) const {
+    return face == other.face && glyph == other.glyph &&
+           phase_x == other.phase_x && phase_y == other.phase_y &&
+           aliased == other.aliased && size == other.size &&
+           outline_width == other.outline_width;
+  }
+};
+
+struct GlyphKeyHash {
+  size_t operator()(const GlyphKey& key) const;
+};
+
+// Bytes a cached mask costs: its coverage plus a rough per-entry
+// bookkeeping cost (list node, bucket).
+struct GlyphMaskWeight {
+  size_t operator()(const GlyphMask& mask) const;
+};
+
+// LRU cache of rasterized glyph masks bounded by a byte budget. Fill and
+// outline coverage of the same glyph are separate entries.
+class GlyphCache {
+ public:
+  explicit GlyphCache(size_t budget = kDefaultGlyphCacheBudget)
+      : cache_(budget) {}
+
+  // Returns the cached mask and marks it most recently used, or nullptr.
+  const GlyphMask* find(const GlyphKey& key) { return cache_.find(key); }
+  // Stores |mask| as LruCache::insert does: once the cache is full, the
+  // storage of an evicted mask is swapped into |mask| for the next miss.
+  // Returns nullptr and leaves |mask| untouched when the mask alone exceeds
+  // the budget.
+  const GlyphMask* insert(const GlyphKey& key, GlyphMask& mask) {
+    return cache_.insert(key, mask);
+  }
+
+  void setBudget(size_t budget) { cache_.setCapacity(budget); }
+  void clear() { cache_.clear(); }
+  GlyphCacheStats stats() const;
+
+ private:
+  LruCache<GlyphKey, GlyphMask, GlyphKeyHash, std::equal_to<>,
+      GlyphMaskWeight>
+      cache_;
+};
+
+}  // namespace simpledwrite
@@ -0,0 +1,191 @@
+#pragma once
+
+// simpledwrite internal backend interface
+// https://github.com/fecf/simpledwrite
+
+#include <exception>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "simpledwrite.h"
+#include "simpledwrite_utf.h"
+
+namespace simpledwrite {
+
+constexpr int kMaxLayoutSize = 16384;
+constexpr size_t kDefaultLayoutCacheCapacity = 64;
+
+// Font attributes of a Layout; backends intern one text format per key.
+struct TextFormatKey {
+  explicit TextFormatKey(const Layout& layout)
+      : font_size(layout.font_size),
+        font_weight(layout.font_weight),
+        font_style(layout.font_style),
+        font_stretch(layout.font_stretch) {}
+  bool operator==(const TextFormatKey& other) const = default;
+
+  int font_size;
+  FontWeight font_weight;
+  FontStyle font_style;
+  FontStretch font_stretch;
+};
+struct TextFormatKeyHash {
+  size_t operator()(const TextFormatKey& key) const {
+    return std::hash<int>()(key.font_size) ^
+           ((size_t)key.font_weight << 16 | (size_t)key.font_stretch << 8 |
+               (size_t)key.font_style) * 0x9e3779b9;
+  }
+};
+
+// Text plus the Layout inputs that affect shaping and line breaking. The
+// Ref form lets cache lookups go without copying the text.
+struct LayoutKeyRef {
+  std::u16string_view text;
+  const Layout* layout;
+};
+struct LayoutKey {
+  LayoutKey(std::u16string_view text, const Layout& layout)
+      : text(text), layout(layout) {}
+  explicit LayoutKey(const LayoutKeyRef& ref)
+      : text(ref.text), layout(*ref.layout) {}
+  // Reuses the text storage.
+  LayoutKey& operator=(const LayoutKeyRef& ref) {
+    text.assign(ref.text);
+    layout = *ref.layout;
+    return *this;
+  }
+
+  std::u16string text;
+  Layout layout;
+};
+struct LayoutKeyHash {
+  using is_transparent = void;
+  size_t operator()(const LayoutKeyRef& key) const;
+  size_t operator()(const LayoutKey& key) const {
+    return (*this)(LayoutKeyRef{key.text, &key.layout});
+  }
+};
+struct LayoutKeyEqual {
+  using is_transparent = void;
+  template <class A, class B>
+  bool operator()(const A& a, const B& b) const {
+    return equal(ref(a), ref(b));
+  }
+
+ private:
+  static LayoutKeyRef ref(const LayoutKeyRef& key) { return key; }
+  static LayoutKeyRef ref(const LayoutKey& key) {
+    return {key.text, &key.layout};
+  }
+  static bool equal(const LayoutKeyRef& a, const LayoutKeyRef& b);
+};
+
+// One glyph rasterized on its own for atlases, in pixels relative to the
+// pen position on the baseline. vertical_offset is not applied.
+struct GlyphImage {
+  int left = 0;  // pen to left edge
+  int top = 0;   // baseline to top edge, down positive
+  int width = 0;
+  int height = 0;
+  float advance = 0.0f;
+  float vertical_offset = 0.0f;
+  std::vector<uint8_t> pixels;  // width * height in the atlas page format
+};
+
+// Codepoint of laid out text and its pen position on the baseline, in
+// pixels from the top-left of the Render output. vertical_offset is not
+// applied.
+struct PlacedGlyph {
+  uint32_t codepoint = 0;
+  float x = 0.0f;
+  float y = 0.0f;
+};
+
+// Writes the outputs of |layout| to element |index| of |metrics|.
+inline void store_metrics(
+    const Layout& layout, size_t index, BatchMetrics& metrics) {
+  metrics.width[index] = layout.out_width;
+  metrics.height[index] = layout.out_height;
+  metrics.padding_top[index] = layout.out_padding_top;
+  metrics.padding_left[index] = layout.out_padding_left;
+  metrics.padding_right[index] = layout.out_padding_right;
+  metrics.padding_bottom[index] = layout.out_padding_bottom;
+  metrics.baseline[index] = layout.out_baseline;
+  metrics.ok[index] = 1;
+}
+
+// Failure thrown by the backends; the message and status become
+// SimpleDWrite::GetLastError() and GetLastStatus().
+class Error : public std::runtime_error {
+ public:
+  Error(Status status, const char* message)
+      : std::runtime_error(message), status_(status) {}
+  Error(Status status, const std::string& message)
+      : std::runtime_error(message), status_(status) {}
+
+  Status status() const { return status_; }
+
+ private:
+  Status status_;
+};
+
+// Engine that SimpleDWrite::Init/CalcSize/Render* dispatch to.
+// Failures are reported by throwing Error, except that rendering into a
+// buffer that is too small returns false with layout.out_buffer_size set.
+class SimpleDWriteImpl {
+ public:
+  virtual ~SimpleDWriteImpl() = default;
+
+  // |fs| may be completed in place (locale, default font).
+  virtual bool init(FontSet& fs, float dpi) = 0;
+  virtual bool calcSize(const FontSet& fs, float dpi, std::u16string_view text,
+      Layout& layout) = 0;
+  // calcSize of texts[begin, end) into |metrics|, which is already sized,
+  // sharing one set of scratch state. Failed elements are left with ok 0;
+  // the first failure is thrown once the others are done.
+  virtual void calcSizes(const FontSet& fs, float dpi,
+      std::span<const std::string> texts, size_t begin, size_t end,
+      const Layout& layout, BatchMetrics& metrics) = 0;
+  // Returns false if the output is larger than |buffer_size|.
+  virtual bool render(const FontSet& fs, float dpi, std::u16string_view text,
+      uint8_t* buffer, int buffer_size, Layout& layout,
+      const RenderParams& renderparams) = 0;
+  // |surface| is validated by the caller.
+  virtual bool renderInto(const FontSet& fs, float dpi,
+      std::u16string_view text, const Surface& surface, int x, int y,
+      Layout& layout, const RenderParams& renderparams) = 0;
+  // |glyphrun| is validated against |fs| by the caller. Returns false as
+  // render() does.
+  virtual bool renderGlyphRun(const FontSet& fs, float dpi,
+      const GlyphRun& glyphrun, uint8_t* buffer, int buffer_size,
+      Layout& layout, const RenderParams& renderparams) = 0;
+  // Returns false if no font maps |codepoint|. Uses the font attributes,
+  // renderparams and mode of |params|.
+  virtual bool rasterizeGlyph(const FontSet& fs, float dpi,
+      uint32_t codepoint, const AtlasParams& params, GlyphImage& image) = 0;
+  // Lays out |text| as render() would, filling the Layout outputs and
+  // replacing |glyphs| with the pen of every codepoint.
+  virtual bool placeGlyphs(const FontSet& fs, float dpi,
+      std::u16string_view text, Layout& layout,
+      std::vector<PlacedGlyph>& glyphs) = 0;
+
+  virtual std::vector<FontStats> fontStats() const { return {}; }
+  virtual void setGlyphCacheBudget(size_t) {}
+  virtual GlyphCacheStats glyphCacheStats() const { return {}; }
+  virtual void setLayoutCacheCapacity(size_t entries) = 0;
+  virtual LayoutCacheStats layoutCacheStats() const = 0;
+  // Drops scratch buffers.
+  virtual void trim() = 0;
+};
+
+#ifdef _WIN32
+std::unique_ptr<SimpleDWriteImpl> CreateDWriteImpl();
+#endif
+std::unique_ptr<SimpleDWriteImpl> CreateSoftImpl();
+
+}  // namespace simpledwrite
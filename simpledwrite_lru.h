@@ -0,0 +1,136 @@
+#pragma once
+
+// simpledwrite LRU cache
+// https://github.com/fecf/simpledwrite
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace simpledwrite {
+
+// Weight of an entry in an entry-count bounded LruCache.
+struct EntryCount {
+  template <class Value>
+  size_t operator()(const Value&) const {
+    return 1;
+  }
+};
+
+// LRU map whose entries, each weighing |Weight|()(value), stay within a
+// total capacity: an entry count by default, or e.g. bytes. find() accepts
+// any type |Hash| and |Equal| understand (both must be transparent), so
+// lookups need not build a Key.
+template <class Key, class Value, class Hash, class Equal = std::equal_to<>,
+    class Weight = EntryCount>
+class LruCache {
+ public:
+  explicit LruCache(size_t capacity) : capacity_(capacity) {}
+
+  // Returns the cached value and marks it most recently used, or nullptr.
+  template <class K>
+  Value* find(const K& key) {
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+      ++misses_;
+      return nullptr;
+    }
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return &it->second->value;
+  }
+
+  // Stores |key| and |value|, evicting least recently used entries until
+  // it fits. When an eviction makes the room, the evicted entry's storage
+  // is reused and its value is swapped out into |value|, so a warm cache
+  // inserts without allocating. |key| may be any type Key can be
+  // constructed and assigned from. Returns nullptr and leaves |value|
+  // untouched if |value| alone outweighs the capacity. The pointer stays
+  // valid until the next insert(), setCapacity() or clear().
+  template <class K>
+  Value* insert(const K& key, Value& value) {
+    const size_t weight = Weight()(value);
+    if (weight > capacity_) {
+      return nullptr;
+    }
+    auto it = map_.find(key);
+    if (it != map_.end()) {
+      weight_ -= it->second->weight;
+      lru_.erase(it->second);
+      map_.erase(it);
+    }
+    // Evict while the oldest entry alone would not make room, then reuse
+    // the one that does.
+    while (!lru_.empty() &&
+           weight_ - lru_.back().weight + weight > capacity_) {
+      evictOne();
+    }
+    if (weight_ + weight <= capacity_) {
+      lru_.push_front(Entry{Key(key), std::move(value), weight});
+      map_.emplace(lru_.front().key, lru_.begin());
+      weight_ += weight;
+      return &lru_.front().value;
+    }
+    auto node = map_.extract(lru_.back().key);
+    lru_.splice(lru_.begin(), lru_, std::prev(lru_.end()));
+    Entry& entry = lru_.front();
+    weight_ += weight - entry.weight;
+    ++evictions_;
+    entry.key = key;
+    std::swap(entry.value, value);
+    entry.weight = weight;
+    node.key() = key;
+    node.mapped() = lru_.begin();
+    map_.insert(std::move(node));
+    return &entry.value;
+  }
+
+  void setCapacity(size_t capacity) {
+    capacity_ = capacity;
+    while (weight_ > capacity_) {
+      evictOne();
+    }
+  }
+
+  void clear() {
+    lru_.clear();
+    map_.clear();
+    weight_ = 0;
+  }
+
+  size_t size() const { return map_.size(); }
+  size_t weight() const { return weight_; }
+  size_t capacity() const { return capacity_; }
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+  uint64_t evictions() const { return evictions_; }
+
+ private:
+  struct Entry {
+    Key key;
+    Value value;
+    size_t weight;
+  };
+
+  void evictOne() {
+    weight_ -= lru_.back().weight;
+    map_.erase(lru_.back().key);
+    lru_.pop_back();
+    ++evictions_;
+  }
+
+  std::list<Entry> lru_;  // most recently used first
+  std::unordered_map<Key, typename std::list<Entry>::iterator, Hash, Equal>
+      map_;
+  size_t capacity_;
+  size_t weight_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
+};
+
+}  // namespace simpledwrite
@@ -0,0 +1,427 @@
+#include "simpledwrite_pixel.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if !defined(SIMPLEDWRITE_NO_SIMD) &&                                \
+    (defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SIMPLEDWRITE_SSE2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMPLEDWRITE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SIMPLEDWRITE_TARGET_AVX2
+#endif
+
+namespace simpledwrite {
+
+namespace {
+
+// Scalar kernels. They define the exact results; the vector versions below
+// perform the same arithmetic and handle the bulk of each row.
+
+void premultiplied_to_straight_scalar(
+    const uint8_t* src, uint8_t* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t* p = src + i * 4;
+    uint8_t* q = dst + i * 4;
+    const uint8_t a = p[3];
+    if (a == 0) {
+      q[0] = q[1] = q[2] = q[3] = 0;
+      continue;
+    }
+    const float inv = 255.0f / a;
+    q[0] = (uint8_t)std::min(255.0f, p[0] * inv + 0.5f);
+    q[1] = (uint8_t)std::min(255.0f, p[1] * inv + 0.5f);
+    q[2] = (uint8_t)std::min(255.0f, p[2] * inv + 0.5f);
+    q[3] = a;
+  }
+}
+
+void straight_to_premultiplied_scalar(
+    const uint8_t* src, uint8_t* dst, size_t count) {
+  auto mul = [](int c, int a) {
+    const int t = c * a + 128;
+    return (uint8_t)((t + (t >> 8)) >> 8);
+  };
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t* p = src + i * 4;
+    uint8_t* q = dst + i * 4;
+    const uint8_t a = p[3];
+    q[0] = mul(p[0], a);
+    q[1] = mul(p[1], a);
+    q[2] = mul(p[2], a);
+    q[3] = a;
+  }
+}
+
+void swap_red_blue_scalar(const uint8_t* src, uint8_t* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t* p = src + i * 4;
+    uint8_t* q = dst + i * 4;
+    const uint8_t b = p[0];
+    const uint8_t r = p[2];
+    q[0] = r;
+    q[1] = p[1];
+    q[2] = b;
+    q[3] = p[3];
+  }
+}
+
+void extract_alpha_scalar(const uint8_t* src, uint8_t* dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = src[i * 4 + 3];
+  }
+}
+
+#ifdef SIMPLEDWRITE_SSE2
+
+bool has_avx2() {
+  static const bool avx2 = [] {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+      return false;
+    }
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+      return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+  }();
+  return avx2;
+}
+
+// One pixel per vector: (c0, c1, c2, a) -> c * (255 / a) + 0.5, alpha kept.
+inline __m128i unpremultiply_pixel_sse2(__m128i pixel) {
+  const __m128 v = _mm_cvtepi32_ps(pixel);
+  const __m128 a = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+  const __m128 inv = _mm_div_ps(_mm_set1_ps(255.0f), a);
+  __m128 c = _mm_add_ps(_mm_mul_ps(v, inv), _mm_set1_ps(0.5f));
+  c = _mm_min_ps(c, _mm_set1_ps(255.0f));
+  // Alpha lane keeps a, zero alpha clears the pixel.
+  const __m128 alpha_lane =
+      _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+  c = _mm_or_ps(_mm_andnot_ps(alpha_lane, c), _mm_and_ps(alpha_lane, v));
+  c = _mm_and_ps(c, _mm_cmpgt_ps(a, _mm_setzero_ps()));
+  return _mm_cvttps_epi32(c);
+}
+
+size_t premultiplied_to_straight_sse2(
+    const uint8_t* src, uint8_t* dst, size_t count) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+    const __m128i lo = _mm_unpacklo_epi8(v, zero);
+    const __m128i hi = _mm_unpackhi_epi8(v, zero);
+    const __m128i p0 = unpremultiply_pixel_sse2(_mm_unpacklo_epi16(lo, zero));
+    const __m128i p1 = unpremultiply_pixel_sse2(_mm_unpackhi_epi16(lo, zero));
+    const __m128i p2 = unpremultiply_pixel_sse2(_mm_unpacklo_epi16(hi, zero));
+    const __m128i p3 = unpremultiply_pixel_sse2(_mm_unpackhi_epi16(hi, zero));
+    const __m128i out = _mm_packus_epi16(
+        _mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+    _mm_storeu_si128((__m128i*)(dst + i * 4), out);
+  }
+  return i;
+}
+
+// 16-bit channels (c0, c1, c2, a) x 2 pixels -> c * a / 255 rounded.
+inline __m128i premultiply_sse2(__m128i v) {
+  const __m128i a = _mm_shufflehi_epi16(
+      _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(v, a), _mm_set1_epi16(128));
+  t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+  const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  return _mm_or_si128(
+      _mm_andnot_si128(alpha_lanes, t), _mm_and_si128(alpha_lanes, v));
+}
+
+size_t straight_to_premultiplied_sse2(
+    const uint8_t* src, uint8_t* dst, size_t count) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+    const __m128i lo = premultiply_sse2(_mm_unpacklo_epi8(v, zero));
+    const __m128i hi = premultiply_sse2(_mm_unpackhi_epi8(v, zero));
+    _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+size_t swap_red_blue_sse2(const uint8_t* src, uint8_t* dst, size_t count) {
+  const __m128i keep = _mm_set1_epi32((int)0xff00ff00);
+  const __m128i low = _mm_set1_epi32(0x000000ff);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+    const __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), low);
+    const __m128i b = _mm_slli_epi32(_mm_and_si128(v, low), 16);
+    const __m128i out = _mm_or_si128(_mm_and_si128(v, keep), _mm_or_si128(r, b));
+    _mm_storeu_si128((__m128i*)(dst + i * 4), out);
+  }
+  return i;
+}
+
+size_t extract_alpha_sse2(const uint8_t* src, uint8_t* dst, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i* p = (const __m128i*)(src + i * 4);
+    const __m128i a0 = _mm_srli_epi32(_mm_loadu_si128(p), 24);
+    const __m128i a1 = _mm_srli_epi32(_mm_loadu_si128(p + 1), 24);
+    const __m128i a2 = _mm_srli_epi32(_mm_loadu_si128(p + 2), 24);
+    const __m128i a3 = _mm_srli_epi32(_mm_loadu_si128(p + 3), 24);
+    const __m128i out = _mm_packus_epi16(
+        _mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3));
+    _mm_storeu_si128((__m128i*)(dst + i), out);
+  }
+  return i;
+}
+
+// AVX2 versions. 128-bit lanes pack independently, so results are put
+// back in order with a cross-lane permute where needed.
+
+SIMPLEDWRITE_TARGET_AVX2 inline __m256i unpremultiply_pixels_avx2(
+    const uint8_t* src) {
+  // Two pixels per vector, one per 128-bit lane.
+  const __m256 v = _mm256_cvtepi32_ps(
+      _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)src)));
+  const __m256 a = _mm256_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+  const __m256 inv = _mm256_div_ps(_mm256_set1_ps(255.0f), a);
+  __m256 c = _mm256_add_ps(_mm256_mul_ps(v, inv), _mm256_set1_ps(0.5f));
+  c = _mm256_min_ps(c, _mm256_set1_ps(255.0f));
+  const __m256 alpha_lane =
+      _mm256_castsi256_ps(_mm256_set_epi32(-1, 0, 0, 0, -1, 0, 0, 0));
+  c = _mm256_blendv_ps(c, v, alpha_lane);
+  c = _mm256_and_ps(c, _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GT_OQ));
+  return _mm256_cvttps_epi32(c);
+}
+
+SIMPLEDWRITE_TARGET_AVX2 size_t premultiplied_to_straight_avx2(
+    const uint8_t* src, uint8_t* dst, size_t count) {
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const uint8_t* p = src + i * 4;
+    const __m256i p01 = unpremultiply_pixels_avx2(p);
+    const __m256i p23 = unpremultiply_pixels_avx2(p + 8);
+    const __m256i p45 = unpremultiply_pixels_avx2(p + 16);
+    const __m256i p67 = unpremultiply_pixels_avx2(p + 24);
+    const __m256i packed = _mm256_packus_epi16(
+        _mm256_packs_epi32(p01, p23), _mm256_packs_epi32(p45, p67));
+    _mm256_storeu_si256((__m256i*)(dst + i * 4),
+        _mm256_permutevar8x32_epi32(packed, order));
+  }
+  return i;
+}
+
+SIMPLEDWRITE_TARGET_AVX2 inline __m256i premultiply_avx2(__m256i v) {
+  const __m256i a = _mm256_shufflehi_epi16(
+      _mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)),
+      _MM_SHUFFLE(3, 3, 3, 3));
+  __m256i t =
+      _mm256_add_epi16(_mm256_mullo_epi16(v, a), _mm256_set1_epi16(128));
+  t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+  return _mm256_blend_epi16(t, v, 0x88);
+}
+
+SIMPLEDWRITE_TARGET_AVX2 size_t straight_to_premultiplied_avx2(
+    const uint8_t* src, uint8_t* dst, size_t count) {
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i v = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+    const __m256i lo = premultiply_avx2(_mm256_unpacklo_epi8(v, zero));
+    const __m256i hi = premultiply_avx2(_mm256_unpackhi_epi8(v, zero));
+    _mm256_storeu_si256(
+        (__m256i*)(dst + i * 4), _mm256_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+SIMPLEDWRITE_TARGET_AVX2 size_t swap_red_blue_avx2(
+    const uint8_t* src, uint8_t* dst, size_t count) {
+  const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8,
+      11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i v = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+    _mm256_storeu_si256(
+        (__m256i*)(dst + i * 4), _mm256_shuffle_epi8(v, shuffle));
+  }
+  return i;
+}
+
+SIMPLEDWRITE_TARGET_AVX2 size_t extract_alpha_avx2(
+    const uint8_t* src, uint8_t* dst, size_t count) {
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    const __m256i* p = (const __m256i*)(src + i * 4);
+    const __m256i a0 = _mm256_srli_epi32(_mm256_loadu_si256(p), 24);
+    const __m256i a1 = _mm256_srli_epi32(_mm256_loadu_si256(p + 1), 24);
+    const __m256i a2 = _mm256_srli_epi32(_mm256_loadu_si256(p + 2), 24);
+    const __m256i a3 = _mm256_srli_epi32(_mm256_loadu_si256(p + 3), 24);
+    const __m256i packed = _mm256_packus_epi16(
+        _mm256_packs_epi32(a0, a1), _mm256_packs_epi32(a2, a3));
+    _mm256_storeu_si256(
+        (__m256i*)(dst + i), _mm256_permutevar8x32_epi32(packed, order));
+  }
+  return i;
+}
+
+#endif  // SIMPLEDWRITE_SSE2
+
+}  // namespace
+
+int BytesPerPixel(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::A8:
+      return 1;
+    case PixelFormat::RGB565:
+      return 2;
+    case PixelFormat::BGRA_PREMULTIPLIED:
+    case PixelFormat::RGBA_STRAIGHT:
+    default:
+      return 4;
+  }
+}
+
+void PremultipliedToStraight(const uint8_t* src, uint8_t* dst, size_t count) {
+  size_t done = 0;
+#ifdef SIMPLEDWRITE_SSE2
+  done = has_avx2() ? premultiplied_to_straight_avx2(src, dst, count)
+                    : premultiplied_to_straight_sse2(src, dst, count);
+#endif
+  premultiplied_to_straight_scalar(
+      src + done * 4, dst + done * 4, count - done);
+}
+
+void StraightToPremultiplied(const uint8_t* src, uint8_t* dst, size_t count) {
+  size_t done = 0;
+#ifdef SIMPLEDWRITE_SSE2
+  done = has_avx2() ? straight_to_premultiplied_avx2(src, dst, count)
+                    : straight_to_premultiplied_sse2(src, dst, count);
+#endif
+  straight_to_premultiplied_scalar(
+      src + done * 4, dst + done * 4, count - done);
+}
+
+void SwapRedBlue(const uint8_t* src, uint8_t* dst, size_t count) {
+  size_t done = 0;
+#ifdef SIMPLEDWRITE_SSE2
+  done = has_avx2() ? swap_red_blue_avx2(src, dst, count)
+                    : swap_red_blue_sse2(src, dst, count);
+#endif
+  swap_red_blue_scalar(src + done * 4, dst + done * 4, count - done);
+}
+
+void ExtractAlpha(const uint8_t* src, uint8_t* dst, size_t count) {
+  size_t done = 0;
+#ifdef SIMPLEDWRITE_SSE2
+  done = has_avx2() ? extract_alpha_avx2(src, dst, count)
+                    : extract_alpha_sse2(src, dst, count);
+#endif
+  extract_alpha_scalar(src + done * 4, dst + done, count - done);
+}
+
+void fill_rect(uint8_t* bgra, int stride, int width, int height,
+    const Color& color) {
+  const float a = std::clamp(color.a, 0.0f, 1.0f);
+  const uint8_t value[4] = {
+      (uint8_t)(std::clamp(color.b * a, 0.0f, 1.0f) * 255.0f + 0.5f),
+      (uint8_t)(std::clamp(color.g * a, 0.0f, 1.0f) * 255.0f + 0.5f),
+      (uint8_t)(std::clamp(color.r * a, 0.0f, 1.0f) * 255.0f + 0.5f),
+      (uint8_t)(a * 255.0f + 0.5f),
+  };
+  for (int y = 0; y < height; ++y) {
+    uint8_t* row = bgra + (size_t)y * stride;
+    for (int x = 0; x < width; ++x) {
+      std::copy(value, value + 4, row + x * 4);
+    }
+  }
+}
+
+void alpha_mask(uint8_t* a8, int stride, const uint8_t* fill,
+    const uint8_t* outline, int mask_stride, int width, int height,
+    const RenderParams& renderparams) {
+  const float fill_alpha =
+      std::clamp(renderparams.foreground_color.a, 0.0f, 1.0f) / 255.0f;
+  const float outline_alpha =
+      std::clamp(renderparams.outline_color.a, 0.0f, 1.0f) / 255.0f;
+  for (int y = 0; y < height; ++y) {
+    const uint8_t* f = fill + (size_t)y * mask_stride;
+    const uint8_t* o = outline ? outline + (size_t)y * mask_stride : nullptr;
+    uint8_t* dst = a8 + (size_t)y * stride;
+    for (int x = 0; x < width; ++x) {
+      const float fa = f[x] * fill_alpha;
+      const float oa = o ? o[x] * outline_alpha : 0.0f;
+      dst[x] = (uint8_t)((fa + oa * (1.0f - fa)) * 255.0f + 0.5f);
+    }
+  }
+}
+
+void composite_mask(uint8_t* bgra, int stride, const uint8_t* mask,
+    int mask_stride, int width, int height, const Color& color) {
+  const float a = std::clamp(color.a, 0.0f, 1.0f);
+  const float r = std::clamp(color.r, 0.0f, 1.0f) * a * 255.0f;
+  const float g = std::clamp(color.g, 0.0f, 1.0f) * a * 255.0f;
+  const float b = std::clamp(color.b, 0.0f, 1.0f) * a * 255.0f;
+  for (int y = 0; y < height; ++y) {
+    const uint8_t* src = mask + (size_t)y * mask_stride;
+    uint8_t* dst = bgra + (size_t)y * stride;
+    for (int x = 0; x < width; ++x) {
+      if (src[x] == 0) {
+        continue;
+      }
+      const float coverage = src[x] / 255.0f;
+      const float inv = 1.0f - a * coverage;
+      uint8_t* p = dst + x * 4;
+      p[0] = (uint8_t)(b * coverage + p[0] * inv + 0.5f);
+      p[1] = (uint8_t)(g * coverage + p[1] * inv + 0.5f);
+      p[2] = (uint8_t)(r * coverage + p[2] * inv + 0.5f);
+      p[3] = (uint8_t)(a * 255.0f * coverage + p[3] * inv + 0.5f);
+    }
+  }
+}
+
+void convert_bgra_row(
+    const uint8_t* src, uint8_t* dst, int width, PixelFormat format) {
+  switch (format) {
+    case PixelFormat::BGRA_PREMULTIPLIED:
+      std::memcpy(dst, src, (size_t)width * 4);
+      break;
+    case PixelFormat::A8:
+      ExtractAlpha(src, dst, width);
+      break;
+    case PixelFormat::RGBA_STRAIGHT:
+      PremultipliedToStraight(src, dst, width);
+      SwapRedBlue(dst, dst, width);
+      break;
+    case PixelFormat::RGB565:
+      for (int x = 0; x < width; ++x) {
+        const uint8_t* p = src + x * 4;
+        const uint16_t v =
+            (uint16_t)((p[2] >> 3) << 11 | (p[1] >> 2) << 5 | p[0] >> 3);
+        dst[x * 2] = (uint8_t)v;
+        dst[x * 2 + 1] = (uint8_t)(v >> 8);
+      }
+      break;
+  }
+}
+
+}  // namespace simpledwrite
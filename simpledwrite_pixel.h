@@ -0,0 +1,32 @@
+#pragma once
+
+// simpledwrite pixel format conversion and compositing
+// https://github.com/fecf/simpledwrite
+
+#include <cstdint>
+
+#include "simpledwrite.h"
+
+namespace simpledwrite {
+
+// Converts |width| premultiplied BGRA pixels from |src| to |format| at |dst|.
+void convert_bgra_row(
+    const uint8_t* src, uint8_t* dst, int width, PixelFormat format);
+
+// Fills a width x height rectangle of BGRA rows |stride| bytes apart with
+// |color| premultiplied.
+void fill_rect(uint8_t* bgra, int stride, int width, int height,
+    const Color& color);
+
+// Source-over of |color| through a width x height |mask| onto premultiplied
+// BGRA. Rows are |stride| bytes apart in |bgra| and |mask_stride| in |mask|.
+void composite_mask(uint8_t* bgra, int stride, const uint8_t* mask,
+    int mask_stride, int width, int height, const Color& color);
+
+// The alpha composite_mask() would leave over a transparent background
+// after the outline and then the fill, written as A8. |outline| may be null.
+void alpha_mask(uint8_t* a8, int stride, const uint8_t* fill,
+    const uint8_t* outline, int mask_stride, int width, int height,
+    const RenderParams& renderparams);
+
+}  // namespace simpledwrite
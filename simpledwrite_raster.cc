@@ -0,0 +1,345 @@
+#include "simpledwrite_raster.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace simpledwrite {
+
+void Path::reset(float scale, float dx, float dy) {
+  points_.clear();
+  contour_ends_.clear();
+  contour_begin_ = 0;
+  scale_ = scale;
+  dx_ = dx;
+  dy_ = dy;
+}
+
+void Path::moveTo(float x, float y) {
+  closeContour();
+  last_ = map(x, y);
+  points_.push_back(last_);
+}
+
+void Path::lineTo(float x, float y) { addPoint(map(x, y)); }
+
+void Path::quadTo(float cx, float cy, float x, float y) {
+  const Point p0 = last_;
+  const Point p1 = map(cx, cy);
+  const Point p2 = map(x, y);
+  const float devx = p0.x - 2.0f * p1.x + p2.x;
+  const float devy = p0.y - 2.0f * p1.y + p2.y;
+  const float devsq = devx * devx + devy * devy;
+  if (devsq < 0.333f) {
+    addPoint(p2);
+    return;
+  }
+  const int n = 1 + (int)std::sqrt(std::sqrt(3.0f * devsq));
+  for (int i = 1; i <= n; ++i) {
+    const float t = (float)i / n;
+    const float mt = 1.0f - t;
+    addPoint({mt * mt * p0.x + 2.0f * mt * t * p1.x + t * t * p2.x,
+        mt * mt * p0.y + 2.0f * mt * t * p1.y + t * t * p2.y});
+  }
+}
+
+void Path::cubicTo(
+    float cx0, float cy0, float cx1, float cy1, float x, float y) {
+  const Point p0 = last_;
+  const Point p1 = map(cx0, cy0);
+  const Point p2 = map(cx1, cy1);
+  const Point p3 = map(x, y);
+  const float dx0 = p0.x - 2.0f * p1.x + p2.x;
+  const float dy0 = p0.y - 2.0f * p1.y + p2.y;
+  const float dx1 = p1.x - 2.0f * p2.x + p3.x;
+  const float dy1 = p1.y - 2.0f * p2.y + p3.y;
+  const float devsq =
+      std::max(dx0 * dx0 + dy0 * dy0, dx1 * dx1 + dy1 * dy1) * 2.25f;
+  if (devsq < 0.333f) {
+    addPoint(p3);
+    return;
+  }
+  const int n = 1 + (int)std::sqrt(std::sqrt(3.0f * devsq));
+  for (int i = 1; i <= n; ++i) {
+    const float t = (float)i / n;
+    const float mt = 1.0f - t;
+    const float a = mt * mt * mt;
+    const float b = 3.0f * mt * mt * t;
+    const float c = 3.0f * mt * t * t;
+    const float d = t * t * t;
+    addPoint({a * p0.x + b * p1.x + c * p2.x + d * p3.x,
+        a * p0.y + b * p1.y + c * p2.y + d * p3.y});
+  }
+}
+
+void Path::close() { closeContour(); }
+
+void Path::addPoint(Point p) {
+  points_.push_back(p);
+  last_ = p;
+}
+
+void Path::closeContour() {
+  const uint32_t size = (uint32_t)points_.size();
+  if (size - contour_begin_ < 2) {
+    points_.resize(contour_begin_);
+  } else {
+    contour_ends_.push_back(size);
+  }
+  contour_begin_ = (uint32_t)points_.size();
+}
+
+void Path::bounds(
+    float& left, float& top, float& right, float& bottom) const {
+  left = top = right = bottom = 0.0f;
+  for (size_t i = 0; i < points_.size(); ++i) {
+    const Point& p = points_[i];
+    left = i ? std::min(left, p.x) : p.x;
+    top = i ? std::min(top, p.y) : p.y;
+    right = i ? std::max(right, p.x) : p.x;
+    bottom = i ? std::max(bottom, p.y) : p.y;
+  }
+}
+
+static void add_polygon(Path& out, const Point* points, int count) {
+  float area = 0.0f;
+  for (int i = 0; i < count; ++i) {
+    const Point& a = points[i];
+    const Point& b = points[(i + 1) % count];
+    area += a.x * b.y - b.x * a.y;
+  }
+  if (area > 0.0f) {
+    for (int i = 0; i < count; ++i) {
+      out.addPoint(points[i]);
+    }
+  } else {
+    for (int i = count - 1; i >= 0; --i) {
+      out.addPoint(points[i]);
+    }
+  }
+  out.closeContour();
+}
+
+void stroke_path(const Path& path, float width, Path& out) {
+  out.reset(1.0f, 0.0f, 0.0f);
+  const float hw = width * 0.5f;
+  if (hw <= 0.0f) {
+    return;
+  }
+  const float kPi = 3.14159265f;
+  const int segments = std::clamp((int)std::ceil(2.0f * kPi * hw), 8, 64);
+  const float step = 2.0f * kPi / segments;
+  // Turns whose bevel strays less than this from the round join get the
+  // bevel alone; straight runs of a flattened curve need no join at all.
+  const float kTolerance = 1.0f / 16.0f;
+
+  const std::vector<Point>& points = path.points();
+  uint32_t begin = 0;
+  for (uint32_t end : path.contourEnds()) {
+    const uint32_t n = end - begin;
+    // Direction of the last segment that has a length, for the first join.
+    float ux = 0.0f;
+    float uy = 0.0f;
+    for (uint32_t i = n; i-- > 0;) {
+      const Point a = points[begin + i];
+      const Point b = points[begin + (i + 1) % n];
+      const float len = std::hypot(b.x - a.x, b.y - a.y);
+      if (len > 1e-6f) {
+        ux = (b.x - a.x) / len;
+        uy = (b.y - a.y) / len;
+        break;
+      }
+    }
+    if (ux == 0.0f && uy == 0.0f) {
+      // A single point: a dot.
+      Point dot[64];
+      const Point a = points[begin];
+      for (int k = 0; k < segments; ++k) {
+        dot[k] = {a.x + std::cos(step * k) * hw, a.y + std::sin(step * k) * hw};
+      }
+      add_polygon(out, dot, segments);
+      begin = end;
+      continue;
+    }
+
+    for (uint32_t i = 0; i < n; ++i) {
+      const Point a = points[begin + i];
+      const Point b = points[begin + (i + 1) % n];
+      const float len = std::hypot(b.x - a.x, b.y - a.y);
+      if (len <= 1e-6f) {
+        continue;
+      }
+      const float vx = (b.x - a.x) / len;
+      const float vy = (b.y - a.y) / len;
+      const float nx = -vy * hw;
+      const float ny = vx * hw;
+      const Point quad[4] = {{a.x + nx, a.y + ny}, {b.x + nx, b.y + ny},
+          {b.x - nx, b.y - ny}, {a.x - nx, a.y - ny}};
+      add_polygon(out, quad, 4);
+
+      // Join at |a| on the outer side of the turn from u to v, as a fan
+      // of arc points; the inner side is covered by the overlapping quads.
+      const float cross = ux * vy - uy * vx;
+      const float angle = std::atan2(cross, ux * vx + uy * vy);
+      if (std::abs(angle) > 1e-3f) {
+        const float side = cross > 0.0f ? -hw : hw;
+        float sx = -uy * side;
+        float sy = ux * side;
+        int steps = (int)std::ceil(std::abs(angle) / step);
+        if (hw * (1.0f - std::cos(angle * 0.5f)) < kTolerance) {
+          steps = 1;
+        }
+        Point fan[66];
+        int count = 0;
+        fan[count++] = a;
+        fan[count++] = {a.x + sx, a.y + sy};
+        const float c = std::cos(angle / steps);
+        const float s = std::sin(angle / steps);
+        for (int k = 1; k < steps; ++k) {
+          const float rx = sx * c - sy * s;
+          sy = sx * s + sy * c;
+          sx = rx;
+          fan[count++] = {a.x + sx, a.y + sy};
+        }
+        fan[count++] = {a.x - vy * side, a.y + vx * side};
+        add_polygon(out, fan, count);
+      }
+      ux = vx;
+      uy = vy;
+    }
+    begin = end;
+  }
+}
+
+void Rasterizer::reset(int width, int height) {
+  width_ = std::max(0, width);
+  height_ = std::max(0, height);
+  stride_ = width_ + 2;
+  acc_.assign((size_t)stride_ * height_, 0.0f);
+}
+
+void Rasterizer::fill(const Path& path, float x, float y) {
+  const std::vector<Point>& points = path.points();
+  uint32_t begin = 0;
+  for (uint32_t end : path.contourEnds()) {
+    for (uint32_t i = begin; i < end; ++i) {
+      const Point& a = points[i];
+      const Point& b = points[i + 1 < end ? i + 1 : begin];
+      line({a.x - x, a.y - y}, {b.x - x, b.y - y});
+    }
+    begin = end;
+  }
+}
+
+void Rasterizer::line(Point p0, Point p1) {
+  if (std::abs(p0.y - p1.y) <= 1e-6f) {
+    return;
+  }
+  float dir = 1.0f;
+  if (p0.y > p1.y) {
+    std::swap(p0, p1);
+    dir = -1.0f;
+  }
+  const float dxdy = (p1.x - p0.x) / (p1.y - p0.y);
+  float x = p0.x;
+  if (p0.y < 0.0f) {
+    x -= p0.y * dxdy;
+  }
+  const float right = (float)width_;
+  const int y0 = std::max(0, (int)std::floor(p0.y));
+  const int y1 = std::min(height_, (int)std::ceil(p1.y));
+  for (int y = y0; y < y1; ++y) {
+    float* row = acc_.data() + (size_t)y * stride_;
+    const float dy = std::min((float)(y + 1), p1.y) - std::max((float)y, p0.y);
+    const float xnext = x + dxdy * dy;
+    const float d = dy * dir;
+    // Clamping keeps the row sum intact, so clipped ink piles up at the
+    // edges instead of leaking into the next row.
+    const float x0 = std::clamp(std::min(x, xnext), 0.0f, right);
+    const float x1 = std::clamp(std::max(x, xnext), 0.0f, right);
+    const float x0floor = std::floor(x0);
+    const int x0i = (int)x0floor;
+    const float x1ceil = std::ceil(x1);
+    const int x1i = (int)x1ceil;
+    if (x1i <= x0i + 1) {
+      const float xmf = 0.5f * (x0 + x1) - x0floor;
+      row[x0i] += d - d * xmf;
+      row[x0i + 1] += d * xmf;
+    } else {
+      const float s = 1.0f / (x1 - x0);
+      const float x0f = x0 - x0floor;
+      const float a0 = 0.5f * s * (1.0f - x0f) * (1.0f - x0f);
+      const float x1f = x1 - x1ceil + 1.0f;
+      const float am = 0.5f * s * x1f * x1f;
+      row[x0i] += d * a0;
+      if (x1i == x0i + 2) {
+        row[x0i + 1] += d * (1.0f - a0 - am);
+      } else {
+        const float a1 = s * (1.5f - x0f);
+        row[x0i + 1] += d * (a1 - a0);
+        for (int xi = x0i + 2; xi < x1i - 1; ++xi) {
+          row[xi] += d * s;
+        }
+        const float a2 = a1 + (x1i - x0i - 3) * s;
+        row[x1i - 1] += d * (1.0f - a2 - am);
+      }
+      row[x1i] += d * am;
+    }
+    x = xnext;
+  }
+}
+
+void Rasterizer::accumulate(uint8_t* out, int stride, bool aliased) {
+  for (int y = 0; y < height_; ++y) {
+    float* row = acc_.data() + (size_t)y * stride_;
+    uint8_t* dst = out + (size_t)y * stride;
+    float sum = 0.0f;
+    for (int x = 0; x < width_; ++x) {
+      sum += row[x];
+      const float coverage = std::min(1.0f, std::abs(sum));
+      if (aliased) {
+        dst[x] = coverage >= 0.5f ? 255 : 0;
+      } else {
+        dst[x] = (uint8_t)(coverage * 255.0f + 0.5f);
+      }
+    }
+    std::fill(row, row + stride_, 0.0f);
+  }
+}
+
+void rasterize_path(
+    const Path& path, bool aliased, Rasterizer& rasterizer, GlyphMask& mask) {
+  if (path.empty()) {
+    mask.left = mask.top = mask.width = mask.height = 0;
+    mask.coverage.clear();
+    return;
+  }
+  float left, top, right, bottom;
+  path.bounds(left, top, right, bottom);
+  mask.left = (int)std::floor(left);
+  mask.top = (int)std::floor(top);
+  mask.width = (int)std::ceil(right) - mask.left + 1;
+  mask.height = (int)std::ceil(bottom) - mask.top + 1;
+  mask.coverage.resize((size_t)mask.width * mask.height);
+  rasterizer.reset(mask.width, mask.height);
+  rasterizer.fill(path, (float)mask.left, (float)mask.top);
+  rasterizer.accumulate(mask.coverage.data(), mask.width, aliased);
+}
+
+void add_mask(const GlyphMask& mask, int x, int y, uint8_t* target,
+    int width, int height) {
+  const int x0 = std::max(0, x + mask.left);
+  const int y0 = std::max(0, y + mask.top);
+  const int x1 = std::min(width, x + mask.left + mask.width);
+  const int y1 = std::min(height, y + mask.top + mask.height);
+  for (int ty = y0; ty < y1; ++ty) {
+    const uint8_t* src = mask.coverage.data() +
+                         (size_t)(ty - y - mask.top) * mask.width - x -
+                         mask.left;
+    uint8_t* dst = target + (size_t)ty * width;
+    for (int tx = x0; tx < x1; ++tx) {
+      dst[tx] = (uint8_t)std::min(255, dst[tx] + src[tx]);
+    }
+  }
+}
+
+}  // namespace simpledwrite
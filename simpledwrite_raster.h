@@ -0,0 +1,99 @@
+#pragma once
+
+// simpledwrite coverage rasterizer
+// https://github.com/fecf/simpledwrite
+
+#include <cstdint>
+#include <vector>
+
+#include "simpledwrite_font.h"
+
+namespace simpledwrite {
+
+struct Point {
+  float x;
+  float y;
+};
+
+// Outline flattened to polygons in pixel space (y down). Outline commands
+// arrive in font units and are mapped with (x * scale + dx, dy - y * scale).
+class Path : public OutlineSink {
+ public:
+  void reset(float scale, float dx, float dy);
+
+  void moveTo(float x, float y) override;
+  void lineTo(float x, float y) override;
+  void quadTo(float cx, float cy, float x, float y) override;
+  void cubicTo(float cx0, float cy0, float cx1, float cy1, float x,
+      float y) override;
+  void close() override;
+
+  // Pixel-space polygon input, used by the stroker.
+  void addPoint(Point p);
+  void closeContour();
+
+  bool empty() const { return points_.empty(); }
+  const std::vector<Point>& points() const { return points_; }
+  const std::vector<uint32_t>& contourEnds() const { return contour_ends_; }
+  void bounds(float& left, float& top, float& right, float& bottom) const;
+
+ private:
+  Point map(float x, float y) const {
+    return {x * scale_ + dx_, dy_ - y * scale_};
+  }
+
+  std::vector<Point> points_;
+  std::vector<uint32_t> contour_ends_;
+  uint32_t contour_begin_ = 0;
+  Point last_ = {0.0f, 0.0f};
+  float scale_ = 1.0f;
+  float dx_ = 0.0f;
+  float dy_ = 0.0f;
+};
+
+// Builds the fillable polygons of a stroke of |width| pixels along the
+// closed contours of |path|, with round joins on the outer side of each
+// turn. All polygons share one orientation so the accumulation buffer
+// yields their union.
+void stroke_path(const Path& path, float width, Path& out);
+
+// Signed-area accumulation scan converter. Each edge deposits its exact
+// area contribution into a float buffer; a running sum per row then yields
+// non-zero coverage without sorting edges or building spans.
+class Rasterizer {
+ public:
+  void reset(int width, int height);
+  // Adds every contour of |path| translated by (-x, -y).
+  void fill(const Path& path, float x = 0.0f, float y = 0.0f);
+  void line(Point p0, Point p1);
+  // Resolves coverage into |out| (width x height, |stride| bytes per row).
+  void accumulate(uint8_t* out, int stride, bool aliased);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+ private:
+  int width_ = 0;
+  int height_ = 0;
+  int stride_ = 0;
+  std::vector<float> acc_;
+};
+
+// Coverage bitmap; (left, top) is the pixel offset from the path origin.
+struct GlyphMask {
+  int left = 0;
+  int top = 0;
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> coverage;
+};
+
+// Rasterizes |path| into a mask just large enough to hold it.
+void rasterize_path(
+    const Path& path, bool aliased, Rasterizer& rasterizer, GlyphMask& mask);
+
+// Saturating add of |mask| placed at (x, y) into a width x height target.
+void add_mask(const GlyphMask& mask, int x, int y, uint8_t* target,
+    int width, int height);
+
+}  // namespace simpledwrite
@@ -0,0 +1,300 @@
+#include "simpledwrite_sdf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace simpledwrite {
+
+namespace {
+
+// Edge colors of a multi-channel field, one bit per channel. Two-channel
+// colors share exactly one channel with each other, which is what keeps
+// the corner between two differently colored edges sharp.
+enum EdgeColor : uint8_t {
+  kRed = 1,
+  kGreen = 2,
+  kBlue = 4,
+  kCyan = kGreen | kBlue,
+  kMagenta = kRed | kBlue,
+  kYellow = kRed | kGreen,
+  kWhite = kRed | kGreen | kBlue,
+};
+
+// Curves arrive flattened, so a turn between segments only counts as a
+// corner past this angle (sine of ~30 degrees).
+constexpr float kCornerSin = 0.5f;
+
+struct Segment {
+  Point a;
+  Point b;
+  uint8_t color = kWhite;
+  // The edge continues as a straight line beyond the first/last segment,
+  // which gives pseudo-distances past the corners.
+  bool extend_start = false;
+  bool extend_end = false;
+};
+
+// Splits each contour into edges at its corners and colors them cyclically
+// so neighbouring edges differ (msdfgen's simple edge coloring).
+void color_edges(const Path& path, std::vector<Segment>& segments) {
+  static const uint8_t kColors[3] = {kCyan, kMagenta, kYellow};
+  const std::vector<Point>& points = path.points();
+  std::vector<Segment> contour;
+  std::vector<size_t> corners;
+  uint32_t begin = 0;
+  for (uint32_t end : path.contourEnds()) {
+    contour.clear();
+    for (uint32_t i = begin; i < end; ++i) {
+      Segment segment;
+      segment.a = points[i];
+      segment.b = points[i + 1 < end ? i + 1 : begin];
+      const float dx = segment.b.x - segment.a.x;
+      const float dy = segment.b.y - segment.a.y;
+      if (dx * dx + dy * dy > 1e-8f) {
+        contour.push_back(segment);
+      }
+    }
+    begin = end;
+    const size_t n = contour.size();
+    if (n == 0) {
+      continue;
+    }
+
+    corners.clear();
+    for (size_t i = 0; i < n; ++i) {
+      const Segment& prev = contour[(i + n - 1) % n];
+      const Segment& cur = contour[i];
+      const float ax = prev.b.x - prev.a.x;
+      const float ay = prev.b.y - prev.a.y;
+      const float bx = cur.b.x - cur.a.x;
+      const float by = cur.b.y - cur.a.y;
+      const float norm = std::sqrt((ax * ax + ay * ay) * (bx * bx + by * by));
+      const float dot = (ax * bx + ay * by) / norm;
+      const float cross = (ax * by - ay * bx) / norm;
+      if (dot <= 0.0f || std::abs(cross) > kCornerSin) {
+        corners.push_back(i);
+      }
+    }
+    // A single corner (teardrop) is split into three edges.
+    if (corners.size() == 1 && n >= 3) {
+      corners.push_back((corners[0] + n / 3) % n);
+      corners.push_back((corners[0] + 2 * n / 3) % n);
+      std::sort(corners.begin(), corners.end());
+    }
+    if (corners.size() >= 2) {
+      const size_t edges = corners.size();
+      for (size_t k = 0; k < edges; ++k) {
+        uint8_t color = kColors[k % 3];
+        if (k == edges - 1 && edges % 3 == 1) {
+          color = kColors[1];
+        }
+        const size_t first = corners[k];
+        const size_t last = (corners[(k + 1) % edges] + n - 1) % n;
+        for (size_t i = first;; i = (i + 1) % n) {
+          contour[i].color = color;
+          if (i == last) {
+            break;
+          }
+        }
+        contour[first].extend_start = true;
+        contour[last].extend_end = true;
+      }
+    }
+    segments.insert(segments.end(), contour.begin(), contour.end());
+  }
+}
+
+float normalize(float distance, float range) {
+  return 0.5f + distance / (2.0f * range);
+}
+
+uint8_t encode(float value) {
+  return (uint8_t)std::clamp(value * 255.0f + 0.5f, 0.0f, 255.0f);
+}
+
+float median(float r, float g, float b) {
+  return std::max(std::min(r, g), std::min(std::max(r, g), b));
+}
+
+// Whether interpolating from texel |a| towards its neighbour |b| flips more
+// than one channel across the edge, which shows up as a speck. Only the
+// texel farther from the edge is flagged (msdfgen's clash detection).
+bool clashes(const float* a, const float* b, float threshold) {
+  float a0 = a[0], a1 = a[1], a2 = a[2];
+  float b0 = b[0], b1 = b[1], b2 = b[2];
+  if (std::abs(b0 - a0) < std::abs(b1 - a1)) {
+    std::swap(a0, a1);
+    std::swap(b0, b1);
+  }
+  if (std::abs(b1 - a1) < std::abs(b2 - a2)) {
+    std::swap(a1, a2);
+    std::swap(b1, b2);
+    if (std::abs(b0 - a0) < std::abs(b1 - a1)) {
+      std::swap(a0, a1);
+      std::swap(b0, b1);
+    }
+  }
+  return std::abs(b1 - a1) >= threshold && !(b0 == b1 && b0 == b2) &&
+         std::abs(a2 - 0.5f) >= std::abs(b2 - 0.5f);
+}
+
+}  // namespace
+
+void rasterize_sdf(const Path& path, float range, bool multichannel,
+    Rasterizer& rasterizer, GlyphImage& image) {
+  const int bpp = multichannel ? 4 : 1;
+  if (path.empty()) {
+    image.left = image.top = image.width = image.height = 0;
+    image.pixels.clear();
+    return;
+  }
+  float left, top, right, bottom;
+  path.bounds(left, top, right, bottom);
+  image.left = (int)std::floor(left - range);
+  image.top = (int)std::floor(top - range);
+  image.width = (int)std::ceil(right + range) - image.left;
+  image.height = (int)std::ceil(bottom + range) - image.top;
+  const int width = image.width;
+  const int height = image.height;
+  image.pixels.assign((size_t)width * height * bpp, 0);
+
+  // The sign comes from the non-zero fill so overlapping contours work.
+  std::vector<uint8_t> inside((size_t)width * height);
+  rasterizer.reset(width, height);
+  rasterizer.fill(path, (float)image.left, (float)image.top);
+  rasterizer.accumulate(inside.data(), width, true);
+
+  std::vector<Segment> segments;
+  color_edges(path, segments);
+  // Positive area: the inside is where cross(b - a, p - a) is positive.
+  float area = 0.0f;
+  for (const Segment& segment : segments) {
+    area += segment.a.x * segment.b.y - segment.b.x * segment.a.y;
+  }
+  const float orientation = area >= 0.0f ? 1.0f : -1.0f;
+
+  // Normalized r, g, b per texel until clashes are resolved.
+  std::vector<float> channels(multichannel ? (size_t)width * height * 3 : 0);
+  constexpr float kInfinity = std::numeric_limits<float>::infinity();
+  for (int y = 0; y < height; ++y) {
+    const float py = image.top + y + 0.5f;
+    for (int x = 0; x < width; ++x) {
+      const float px = image.left + x + 0.5f;
+      float nearest = kInfinity;
+      float channel_nearest[3] = {kInfinity, kInfinity, kInfinity};
+      float channel_distance[3] = {0.0f, 0.0f, 0.0f};
+      float channel_along[3] = {1.0f, 1.0f, 1.0f};
+      for (const Segment& segment : segments) {
+        const float abx = segment.b.x - segment.a.x;
+        const float aby = segment.b.y - segment.a.y;
+        const float apx = px - segment.a.x;
+        const float apy = py - segment.a.y;
+        const float length_sq = abx * abx + aby * aby;
+        const float t = (apx * abx + apy * aby) / length_sq;
+        const float tc = std::clamp(t, 0.0f, 1.0f);
+        const float dx = apx - abx * tc;
+        const float dy = apy - aby * tc;
+        const float distance_sq = dx * dx + dy * dy;
+        nearest = std::min(nearest, distance_sq);
+        if (!multichannel) {
+          continue;
+        }
+        // Past an end point, how much |p| lies along the segment direction;
+        // of two segments meeting at a corner the more orthogonal wins.
+        float along = 0.0f;
+        if (t < 0.0f || t > 1.0f) {
+          along = std::abs(dx * abx + dy * aby) /
+                  std::sqrt(distance_sq * length_sq + 1e-12f);
+        }
+        for (int c = 0; c < 3; ++c) {
+          if (!(segment.color & (1 << c))) {
+            continue;
+          }
+          const float tolerance = 1e-5f * std::max(1.0f, distance_sq);
+          if (distance_sq > channel_nearest[c] + tolerance ||
+              (distance_sq >= channel_nearest[c] - tolerance &&
+                  along >= channel_along[c])) {
+            continue;
+          }
+          channel_nearest[c] = distance_sq;
+          channel_along[c] = along;
+          const float cross = abx * apy - aby * apx;
+          float distance = std::sqrt(distance_sq);
+          if ((t < 0.0f && segment.extend_start) ||
+              (t > 1.0f && segment.extend_end)) {
+            distance = std::abs(cross) / std::sqrt(length_sq);
+          }
+          channel_distance[c] =
+              cross * orientation > 0.0f ? distance : -distance;
+        }
+      }
+
+      const size_t index = (size_t)y * width + x;
+      const float sign = inside[index] ? 1.0f : -1.0f;
+      const float distance = std::sqrt(nearest) * sign;
+      uint8_t* out = image.pixels.data() + index * bpp;
+      if (!multichannel) {
+        out[0] = encode(normalize(distance, range));
+        continue;
+      }
+      float r = channel_nearest[0] < kInfinity ? channel_distance[0] : distance;
+      float g = channel_nearest[1] < kInfinity ? channel_distance[1] : distance;
+      float b = channel_nearest[2] < kInfinity ? channel_distance[2] : distance;
+      // Fall back to the true distance where the channels disagree with
+      // the fill about the side, e.g. inside overlapping contours.
+      if ((median(r, g, b) > 0.0f) != (sign > 0.0f)) {
+        r = g = b = distance;
+      }
+      float* texel = channels.data() + index * 3;
+      texel[0] = normalize(r, range);
+      texel[1] = normalize(g, range);
+      texel[2] = normalize(b, range);
+      out[3] = encode(normalize(distance, range));
+    }
+  }
+  if (!multichannel) {
+    return;
+  }
+
+  // Equalize clashing texels to their median, checking the 4-neighbours
+  // and, with a longer threshold, the diagonals.
+  const float threshold = 1.001f / (2.0f * range);
+  const float diagonal = threshold * std::sqrt(2.0f);
+  std::vector<size_t> clashing;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const size_t index = (size_t)y * width + x;
+      const float* texel = channels.data() + index * 3;
+      auto clash = [&](int dx, int dy, float limit) {
+        const int nx = x + dx;
+        const int ny = y + dy;
+        if (nx < 0 || ny < 0 || nx >= width || ny >= height) {
+          return false;
+        }
+        return clashes(texel,
+            channels.data() + ((size_t)ny * width + nx) * 3, limit);
+      };
+      if (clash(-1, 0, threshold) || clash(1, 0, threshold) ||
+          clash(0, -1, threshold) || clash(0, 1, threshold) ||
+          clash(-1, -1, diagonal) || clash(1, -1, diagonal) ||
+          clash(-1, 1, diagonal) || clash(1, 1, diagonal)) {
+        clashing.push_back(index);
+      }
+    }
+  }
+  for (size_t index : clashing) {
+    float* texel = channels.data() + index * 3;
+    texel[0] = texel[1] = texel[2] = median(texel[0], texel[1], texel[2]);
+  }
+  for (size_t index = 0; index < (size_t)width * height; ++index) {
+    const float* texel = channels.data() + index * 3;
+    uint8_t* out = image.pixels.data() + index * 4;
+    out[0] = encode(texel[2]);
+    out[1] = encode(texel[1]);
+    out[2] = encode(texel[0]);
+  }
+}
+
+}  // namespace simpledwrite
@@ -0,0 +1,20 @@
+#pragma once
+
+// simpledwrite signed distance fields
+// https://github.com/fecf/simpledwrite
+
+#include "simpledwrite_impl.h"
+#include "simpledwrite_raster.h"
+
+namespace simpledwrite {
+
+// Distance field of |path| (pixel space, origin on the baseline) sampled at
+// pixel centers, with |range| pixels of margin around the outline. Values
+// are 0.5 + d / (2 * range) scaled to 0..255, d being the distance to the
+// outline in pixels, positive inside. Single channel fields are A8; multi
+// channel ones are BGRA with per-edge-color distances in B, G, R (their
+// median is the field, with sharp corners) and the true distance in A.
+void rasterize_sdf(const Path& path, float range, bool multichannel,
+    Rasterizer& rasterizer, GlyphImage& image);
+
+}  // namespace simpledwrite
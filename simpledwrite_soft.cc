@@ -0,0 +1,985 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "simpledwrite.h"
+#include "simpledwrite_context.h"
+#include "simpledwrite_font.h"
+#include "simpledwrite_glyphcache.h"
+#include "simpledwrite_impl.h"
+#include "simpledwrite_lru.h"
+#include "simpledwrite_pixel.h"
+#include "simpledwrite_raster.h"
+#include "simpledwrite_sdf.h"
+
+namespace simpledwrite {
+
+namespace {
+
+bool is_whitespace(uint32_t c) {
+  return c == ' ' || c == '\t' || c == 0x3000 || c == 0xa0;
+}
+
+bool is_newline(uint32_t c) {
+  return c == '\n' || c == '\r' || c == 0x2028 || c == 0x2029;
+}
+
+bool is_variation_selector(uint32_t c) {
+  return (c >= 0xfe00 && c <= 0xfe0f) || (c >= 0xe0100 && c <= 0xe01ef);
+}
+
+// Ideographic scripts allow a line break between any two characters.
+bool is_ideographic(uint32_t c) {
+  return (c >= 0x2e80 && c <= 0x9fff) || (c >= 0xac00 && c <= 0xd7af) ||
+         (c >= 0xf900 && c <= 0xfaff) || (c >= 0xff00 && c <= 0xffef) ||
+         (c >= 0x20000 && c <= 0x3ffff);
+}
+
+struct Face {
+  FontFace face;
+  float vertical_offset = 0.0f;
+};
+
+struct Family {
+  std::vector<int> faces;  // indices into SoftImpl::faces_
+};
+
+struct Fallback {
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  int family = -1;
+};
+
+struct GlyphItem {
+  const Face* face = nullptr;
+  uint16_t glyph = 0;
+  uint32_t codepoint = 0;
+  float x = 0.0f;        // pen position from line start, DIPs
+  float y = 0.0f;        // offset from the baseline, DIPs, down positive
+  float advance = 0.0f;  // DIPs
+};
+
+struct Line {
+  size_t begin = 0;
+  size_t end = 0;
+  float width = 0.0f;  // without trailing whitespace
+  float top = 0.0f;
+  float baseline = 0.0f;
+  float height = 0.0f;
+};
+
+struct TextLayout {
+  // Empties the layout, keeping the capacity of the vectors.
+  void reset() {
+    glyphs.clear();
+    lines.clear();
+    width = height = em = 0.0f;
+    ink_left = ink_top = ink_right = ink_bottom = 0.0f;
+  }
+
+  std::vector<GlyphItem> glyphs;
+  std::vector<Line> lines;
+  float width = 0.0f;
+  float height = 0.0f;
+  float em = 0.0f;  // DIPs
+  // ink bounds, DIPs
+  float ink_left = 0.0f;
+  float ink_top = 0.0f;
+  float ink_right = 0.0f;
+  float ink_bottom = 0.0f;
+};
+
+// Per-call scratch state and caches of SoftImpl; see ContextPool.
+struct SoftContext {
+  Rasterizer rasterizer;
+  Path path;
+  Path stroke;
+  GlyphMask mask;
+  GlyphCache glyph_cache;
+  TextLayout textlayout;
+  LruCache<LayoutKey, TextLayout, LayoutKeyHash, LayoutKeyEqual> layout_cache{
+      kDefaultLayoutCacheCapacity};
+  std::vector<uint8_t> fill_mask;
+  std::vector<uint8_t> outline_mask;
+  std::vector<uint8_t> pixels;  // BGRA staging for other pixel formats
+  // Face of every family matching the Layout font attributes.
+  std::unordered_map<TextFormatKey, std::vector<const Face*>,
+      TextFormatKeyHash>
+      textformats;
+};
+
+}  // namespace
+
+class SoftImpl : public SimpleDWriteImpl {
+ public:
+  SoftImpl() = default;
+  virtual ~SoftImpl() = default;
+
+  // The dpi is applied per call, so there is nothing to set up for it.
+  bool init(FontSet& fs, float) override {
+    std::lock_guard<std::mutex> lock(init_mutex_);
+    load(fs);
+    return true;
+  }
+
+  std::vector<FontStats> fontStats() const override {
+    std::vector<FontStats> stats;
+    for (const std::unique_ptr<Face>& face : faces_) {
+      FontStats stat;
+      const FaceStyle& style = face->face.style();
+      stat.family = style.families.empty() ? "" : style.families.front();
+      stat.weight = style.weight;
+      stat.italic = style.italic;
+      stat.glyph_count = face->face.numGlyphs();
+      stat.cmap_bytes = face->face.cmapMemoryUsage();
+      stats.push_back(stat);
+    }
+    return stats;
+  }
+
+  void setGlyphCacheBudget(size_t bytes) override {
+    glyph_cache_budget_ = bytes;
+    contexts_.forEach(
+        [bytes](SoftContext& ctx) { ctx.glyph_cache.setBudget(bytes); });
+  }
+
+  GlyphCacheStats glyphCacheStats() const override {
+    GlyphCacheStats stats;
+    contexts_.forEach([&stats](SoftContext& ctx) {
+      const GlyphCacheStats context_stats = ctx.glyph_cache.stats();
+      stats.entries += context_stats.entries;
+      stats.bytes += context_stats.bytes;
+      stats.hits += context_stats.hits;
+      stats.misses += context_stats.misses;
+      stats.evictions += context_stats.evictions;
+    });
+    stats.budget = glyph_cache_budget_;
+    return stats;
+  }
+
+  void setLayoutCacheCapacity(size_t entries) override {
+    layout_cache_capacity_ = entries;
+    contexts_.forEach([entries](SoftContext& ctx) {
+      ctx.layout_cache.setCapacity(entries);
+    });
+  }
+
+  LayoutCacheStats layoutCacheStats() const override {
+    LayoutCacheStats stats;
+    contexts_.forEach([&stats](SoftContext& ctx) {
+      stats.entries += ctx.layout_cache.size();
+      stats.hits += ctx.layout_cache.hits();
+      stats.misses += ctx.layout_cache.misses();
+    });
+    stats.capacity = layout_cache_capacity_;
+    return stats;
+  }
+
+  void trim() override {
+    contexts_.forEach([](SoftContext& ctx) {
+      ctx.rasterizer = Rasterizer();
+      ctx.path = Path();
+      ctx.stroke = Path();
+      ctx.mask = GlyphMask();
+      ctx.fill_mask = std::vector<uint8_t>();
+      ctx.outline_mask = std::vector<uint8_t>();
+      ctx.pixels = std::vector<uint8_t>();
+      ctx.textlayout = TextLayout();
+    });
+  }
+
+  bool calcSize(const FontSet&, float dpi, std::u16string_view text,
+      Layout& layout) override {
+    ensureInit();
+    ContextPool<SoftContext>::Lease ctx = contexts_.acquire();
+    return calcSize(textLayout(*ctx, layout, dpi, text), layout);
+  }
+
+  void calcSizes(const FontSet&, float dpi,
+      std::span<const std::string> texts, size_t begin, size_t end,
+      const Layout& layout, BatchMetrics& metrics) override {
+    ensureInit();
+    ContextPool<SoftContext>::Lease ctx = contexts_.acquire();
+    std::exception_ptr error;
+    Layout out = layout;
+    std::u16string text;
+    for (size_t i = begin; i < end; ++i) {
+      try {
+        utf8_to_u16(texts[i], text);
+        if (calcSize(textLayout(*ctx, layout, dpi, text), out)) {
+          store_metrics(out, i, metrics);
+        }
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  bool render(const FontSet&, float dpi, std::u16string_view text,
+      uint8_t* buffer, int buffer_size, Layout& layout,
+      const RenderParams& renderparams) override {
+    ensureInit();
+    ContextPool<SoftContext>::Lease ctx = contexts_.acquire();
+    return renderBuffer(*ctx, textLayout(*ctx, layout, dpi, text), dpi,
+        buffer, buffer_size, layout, renderparams);
+  }
+
+  bool renderInto(const FontSet&, float dpi, std::u16string_view text,
+      const Surface& surface, int x, int y, Layout& layout,
+      const RenderParams& renderparams) override {
+    ensureInit();
+    ContextPool<SoftContext>::Lease ctx = contexts_.acquire();
+    const TextLayout& textlayout = textLayout(*ctx, layout, dpi, text);
+    if (!calcSize(textlayout, layout)) {
+      return false;
+    }
+    draw(*ctx, textlayout, dpi, surface, x, y, layout, renderparams);
+    return true;
+  }
+
+  bool renderGlyphRun(const FontSet&, float dpi, const GlyphRun& glyphrun,
+      uint8_t* buffer, int buffer_size, Layout& layout,
+      const RenderParams& renderparams) override {
+    ensureInit();
+    ContextPool<SoftContext>::Lease ctx = contexts_.acquire();
+    TextLayout& textlayout = ctx->textlayout;
+    textlayout.reset();
+    createGlyphRunLayout(*ctx, glyphrun, layout, dpi, textlayout);
+    return renderBuffer(
+        *ctx, textlayout, dpi, buffer, buffer_size, layout, renderparams);
+  }
+
+  bool rasterizeGlyph(const FontSet&, float dpi, uint32_t codepoint,
+      const AtlasParams& params, GlyphImage& image) override {
+    ensureInit();
+    ContextPool<SoftContext>::Lease lease = contexts_.acquire();
+    SoftContext& ctx = *lease;
+    const RenderParams& renderparams = params.renderparams;
+    GlyphItem item;
+    mapCodepoint(codepoint, textFormat(ctx, params.layout), item);
+    if (item.glyph == 0) {
+      return false;
+    }
+    const float scale = dpi / 96.0f;
+    const float size = params.layout.font_size;  // em in pixels
+    const FontFace& ff = item.face->face;
+    image.advance = ff.advanceWidth(item.glyph) * size / ff.unitsPerEm();
+    image.vertical_offset = item.face->vertical_offset * scale;
+
+    if (params.mode != AtlasMode::COVERAGE) {
+      ctx.path.reset(size / ff.unitsPerEm(), 0.0f, 0.0f);
+      if (!ff.outline(item.glyph, ctx.path)) {
+        ctx.path.reset(1.0f, 0.0f, 0.0f);
+      }
+      rasterize_sdf(ctx.path, params.sdf_range, params.mode == AtlasMode::MSDF,
+          ctx.rasterizer, image);
+      return true;
+    }
+
+    GlyphKey key;
+    key.face = item.face;
+    key.glyph = item.glyph;
+    key.aliased = renderparams.antialias_mode == AntialiasMode::ALIASED;
+    key.size = size;
+    bool has_path = false;
+    GlyphMask outline;
+    if (renderparams.outline_width > 0.0f) {
+      key.outline_width = renderparams.outline_width * scale;
+      outline = *glyphMask(ctx, key, has_path);
+      key.outline_width = 0.0f;
+    }
+    const GlyphMask& fill = *glyphMask(ctx, key, has_path);
+
+    int left = fill.left;
+    int top = fill.top;
+    int right = fill.left + fill.width;
+    int bottom = fill.top + fill.height;
+    if (outline.width > 0 && outline.height > 0) {
+      left = std::min(left, outline.left);
+      top = std::min(top, outline.top);
+      right = std::max(right, outline.left + outline.width);
+      bottom = std::max(bottom, outline.top + outline.height);
+    }
+    image.left = left;
+    image.top = top;
+    image.width = std::max(0, right - left);
+    image.height = std::max(0, bottom - top);
+    const int width = image.width;
+    const int height = image.height;
+    const PixelFormat format = renderparams.pixel_format;
+    image.pixels.assign((size_t)width * height * BytesPerPixel(format), 0);
+    if (width == 0 || height == 0) {
+      return true;
+    }
+
+    ctx.fill_mask.assign((size_t)width * height, 0);
+    add_mask(fill, -left, -top, ctx.fill_mask.data(), width, height);
+    const uint8_t* outline_mask = nullptr;
+    if (outline.width > 0) {
+      ctx.outline_mask.assign((size_t)width * height, 0);
+      add_mask(outline, -left, -top, ctx.outline_mask.data(), width, height);
+      outline_mask = ctx.outline_mask.data();
+    }
+    if (format == PixelFormat::A8) {
+      alpha_mask(image.pixels.data(), width, ctx.fill_mask.data(), outline_mask,
+          width, width, height, renderparams);
+      return true;
+    }
+    uint8_t* bgra = image.pixels.data();
+    if (format != PixelFormat::BGRA_PREMULTIPLIED) {
+      ctx.pixels.assign((size_t)width * height * 4, 0);
+      bgra = ctx.pixels.data();
+    }
+    if (outline_mask) {
+      composite_mask(bgra, width * 4, outline_mask, width, width, height,
+          renderparams.outline_color);
+    }
+    composite_mask(bgra, width * 4, ctx.fill_mask.data(), width, width, height,
+        renderparams.foreground_color);
+    if (bgra != image.pixels.data()) {
+      const int stride = width * BytesPerPixel(format);
+      for (int y = 0; y < height; ++y) {
+        convert_bgra_row(bgra + (size_t)y * width * 4,
+            image.pixels.data() + (size_t)y * stride, width, format);
+      }
+    }
+    return true;
+  }
+
+  bool placeGlyphs(const FontSet&, float dpi, std::u16string_view text,
+      Layout& layout, std::vector<PlacedGlyph>& glyphs) override {
+    ensureInit();
+    ContextPool<SoftContext>::Lease ctx = contexts_.acquire();
+    const TextLayout& textlayout = textLayout(*ctx, layout, dpi, text);
+    if (!calcSize(textlayout, layout)) {
+      return false;
+    }
+    const float scale = dpi / 96.0f;
+    glyphs.clear();
+    for (const Line& line : textlayout.lines) {
+      for (size_t i = line.begin; i < line.end; ++i) {
+        const GlyphItem& item = textlayout.glyphs[i];
+        PlacedGlyph glyph;
+        glyph.codepoint = item.codepoint;
+        glyph.x = item.x * scale;
+        glyph.y = (line.baseline + item.y) * scale;
+        glyphs.push_back(glyph);
+      }
+    }
+    return true;
+  }
+
+ private:
+  bool renderBuffer(SoftContext& ctx, const TextLayout& textlayout, float dpi,
+      uint8_t* buffer, int buffer_size, Layout& layout,
+      const RenderParams& renderparams) {
+    if (!calcSize(textlayout, layout)) {
+      return false;
+    }
+    layout.out_buffer_size = layout.out_width * layout.out_height *
+                             BytesPerPixel(renderparams.pixel_format);
+
+    if (layout.out_buffer_size > buffer_size) {
+      return false;
+    }
+
+    Surface surface;
+    surface.data = buffer;
+    surface.stride =
+        layout.out_width * BytesPerPixel(renderparams.pixel_format);
+    surface.width = layout.out_width;
+    surface.height = layout.out_height;
+    draw(ctx, textlayout, dpi, surface, 0, 0, layout, renderparams);
+    return true;
+  }
+
+  // Draws |textlayout| (already measured into |layout|) at (x, y) of
+  // |surface|, clipped to the surface.
+  void draw(SoftContext& ctx, const TextLayout& textlayout, float dpi,
+      const Surface& surface, int x, int y, const Layout& layout,
+      const RenderParams& renderparams) {
+    const int width = layout.out_width;
+    const int height = layout.out_height;
+    const int x0 = std::max(0, x);
+    const int y0 = std::max(0, y);
+    const int x1 = std::min(surface.width, x + width);
+    const int y1 = std::min(surface.height, y + height);
+    if (x0 >= x1 || y0 >= y1) {
+      return;
+    }
+    const PixelFormat format = renderparams.pixel_format;
+    uint8_t* target = surface.data + (size_t)y0 * surface.stride +
+                      (size_t)x0 * BytesPerPixel(format);
+
+    const size_t pixels = (size_t)width * height;
+    const float scale = dpi / 96.0f;
+    const float outline_width = renderparams.outline_width * scale;
+    const bool aliased =
+        renderparams.antialias_mode == AntialiasMode::ALIASED;
+    ctx.fill_mask.assign(pixels, 0);
+    ctx.outline_mask.assign(outline_width > 0.0f ? pixels : 0, 0);
+    for (const Line& line : textlayout.lines) {
+      for (size_t i = line.begin; i < line.end; ++i) {
+        const GlyphItem& item = textlayout.glyphs[i];
+        const float px = item.x * scale;
+        const float py =
+            (line.baseline + item.y + item.face->vertical_offset) * scale;
+        // Snap the origin to a subpixel phase so masks can be reused.
+        const int sx = (int)std::floor(px * kSubpixelPhases + 0.5f);
+        const int sy = (int)std::floor(py * kSubpixelPhases + 0.5f);
+        const int ix = (int)std::floor((float)sx / kSubpixelPhases);
+        const int iy = (int)std::floor((float)sy / kSubpixelPhases);
+
+        GlyphKey key;
+        key.face = item.face;
+        key.glyph = item.glyph;
+        key.phase_x = (uint8_t)(sx - ix * kSubpixelPhases);
+        key.phase_y = (uint8_t)(sy - iy * kSubpixelPhases);
+        key.aliased = aliased;
+        key.size = textlayout.em * scale;
+        bool has_path = false;
+        if (outline_width > 0.0f) {
+          key.outline_width = outline_width;
+          const GlyphMask* mask = glyphMask(ctx, key, has_path);
+          add_mask(*mask, ix, iy, ctx.outline_mask.data(), width, height);
+          key.outline_width = 0.0f;
+        }
+        const GlyphMask* mask = glyphMask(ctx, key, has_path);
+        add_mask(*mask, ix, iy, ctx.fill_mask.data(), width, height);
+      }
+    }
+    const size_t mask_offset = (size_t)(y0 - y) * width + (x0 - x);
+    const uint8_t* fill = ctx.fill_mask.data() + mask_offset;
+    const uint8_t* outline =
+        outline_width > 0.0f ? ctx.outline_mask.data() + mask_offset : nullptr;
+    if (format == PixelFormat::A8) {
+      alpha_mask(target, surface.stride, fill, outline, width, x1 - x0,
+          y1 - y0, renderparams);
+      return;
+    }
+
+    // Other formats are composited as BGRA in scratch and converted.
+    uint8_t* bgra = target;
+    int bgra_stride = surface.stride;
+    if (format != PixelFormat::BGRA_PREMULTIPLIED) {
+      bgra_stride = (x1 - x0) * 4;
+      ctx.pixels.resize((size_t)bgra_stride * (y1 - y0));
+      bgra = ctx.pixels.data();
+    }
+    fill_rect(bgra, bgra_stride, x1 - x0, y1 - y0,
+        renderparams.background_color);
+    if (outline) {
+      composite_mask(bgra, bgra_stride, outline, width, x1 - x0, y1 - y0,
+          renderparams.outline_color);
+    }
+    composite_mask(bgra, bgra_stride, fill, width, x1 - x0, y1 - y0,
+        renderparams.foreground_color);
+    if (bgra != target) {
+      for (int ty = 0; ty < y1 - y0; ++ty) {
+        convert_bgra_row(bgra + (size_t)ty * bgra_stride,
+            target + (size_t)ty * surface.stride, x1 - x0, format);
+      }
+    }
+  }
+
+  // Cached fill (or outline, when key.outline_width is set) coverage of a
+  // glyph. ctx.path is rebuilt on a miss unless |has_path| says it is
+  // current.
+  const GlyphMask* glyphMask(
+      SoftContext& ctx, const GlyphKey& key, bool& has_path) {
+    if (const GlyphMask* mask = ctx.glyph_cache.find(key)) {
+      return mask;
+    }
+    if (!has_path) {
+      const FontFace& ff = ((const Face*)key.face)->face;
+      ctx.path.reset(key.size / ff.unitsPerEm(),
+          (float)key.phase_x / kSubpixelPhases,
+          (float)key.phase_y / kSubpixelPhases);
+      if (!ff.outline(key.glyph, ctx.path)) {
+        ctx.path.reset(1.0f, 0.0f, 0.0f);
+      }
+      has_path = true;
+    }
+    if (key.outline_width > 0.0f) {
+      stroke_path(ctx.path, key.outline_width, ctx.stroke);
+      rasterize_path(ctx.stroke, key.aliased, ctx.rasterizer, ctx.mask);
+    } else {
+      rasterize_path(ctx.path, key.aliased, ctx.rasterizer, ctx.mask);
+    }
+    const GlyphMask* mask = ctx.glyph_cache.insert(key, ctx.mask);
+    return mask ? mask : &ctx.mask;
+  }
+
+  // Loads the default fonts on first use if Init was not called, and
+  // rethrows the failure if loading did not succeed.
+  void ensureInit() {
+    if (initialized_) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(init_mutex_);
+    if (init_error_) {
+      std::rethrow_exception(init_error_);
+    }
+    if (!initialized_) {
+      FontSet fs = FontSet::Default();
+      load(fs);
+    }
+  }
+
+  // Loads |fs|, remembering a failure so that later calls report it
+  // instead of falling back to other fonts. init_mutex_ is held.
+  void load(FontSet& fs) {
+    initialized_ = false;
+    init_error_ = nullptr;
+    try {
+      loadFonts(fs);
+    } catch (...) {
+      init_error_ = std::current_exception();
+      throw;
+    }
+    initialized_ = true;
+  }
+
+  void loadFonts(FontSet& fs) {
+    contexts_.clear();
+    faces_.clear();
+    families_.clear();
+    font_families_.clear();
+    fallbacks_.clear();
+    files_.clear();
+
+    if (fs.locale.empty()) {
+      fs.locale = FontSet::Default().locale;
+    }
+
+    if (fs.fonts.empty()) {
+      const std::string family = defaultFamily();
+      if (family.empty()) {
+        throw Error(Status::FONT_NOT_FOUND, "no system font found.");
+      }
+      fs.fonts.push_back(Font(family));
+    }
+
+    for (const Font& font : fs.fonts) {
+      Family family;
+      if (font.data != nullptr && font.data_size) {
+        const uint8_t* data = (const uint8_t*)font.data;
+        const uint32_t count = FontFace::countFaces(data, font.data_size);
+        for (uint32_t i = 0; i < count; ++i) {
+          addFace(family, data, font.data_size, i, font.vertical_offset);
+        }
+      } else {
+        if (font.name.empty()) {
+          throw Error(Status::INVALID_ARGUMENT, "Font::name is empty.");
+        }
+        for (const SystemFontFile& file : scan_system_fonts()) {
+          if (!file.style.hasFamily(font.name)) {
+            continue;
+          }
+          const std::vector<uint8_t>* data = loadFile(file.path);
+          if (data != nullptr) {
+            addFace(family, data->data(), data->size(), file.index,
+                font.vertical_offset);
+          }
+        }
+      }
+      if (family.faces.empty()) {
+        font_families_.push_back(-1);
+      } else {
+        font_families_.push_back((int)families_.size());
+        families_.push_back(std::move(family));
+      }
+    }
+    if (families_.empty()) {
+      throw Error(Status::FONT_NOT_FOUND, "font not found.");
+    }
+
+    for (const FallbackFont& fallbackfont : fs.fallbacks) {
+      Fallback fallback;
+      fallback.ranges = fallbackfont.ranges;
+      fallback.family = findFamily(fallbackfont.family);
+      if (fallback.family >= 0) {
+        fallbacks_.push_back(std::move(fallback));
+      }
+    }
+  }
+
+
+  static std::string defaultFamily() {
+    const std::vector<SystemFontFile>& files = scan_system_fonts();
+    for (const char* name : {"Segoe UI", "DejaVu Sans", "Noto Sans",
+             "Liberation Sans", "Helvetica", "Arial"}) {
+      for (const SystemFontFile& file : files) {
+        if (file.style.hasFamily(name)) {
+          return name;
+        }
+      }
+    }
+    return files.empty() ? std::string() : files.front().style.families[0];
+  }
+
+  const std::vector<uint8_t>* loadFile(const std::string& path) {
+    for (const auto& [filepath, data] : files_) {
+      if (filepath == path) {
+        return data.get();
+      }
+    }
+    auto data = std::make_unique<std::vector<uint8_t>>();
+    if (!read_file(path, *data)) {
+      return nullptr;
+    }
+    files_.emplace_back(path, std::move(data));
+    return files_.back().second.get();
+  }
+
+  void addFace(Family& family, const uint8_t* data, size_t size,
+      uint32_t index, float vertical_offset) {
+    auto face = std::make_unique<Face>();
+    if (!face->face.load(data, size, index)) {
+      return;
+    }
+    face->vertical_offset = vertical_offset;
+    family.faces.push_back((int)faces_.size());
+    faces_.push_back(std::move(face));
+  }
+
+  int findFamily(const std::string& name) const {
+    for (int i = 0; i < (int)families_.size(); ++i) {
+      for (int face : families_[i].faces) {
+        if (faces_[face]->face.style().hasFamily(name)) {
+          return i;
+        }
+      }
+    }
+    return -1;
+  }
+
+  // Closest weight/style/stretch within |family|, in the spirit of the
+  // CSS/DirectWrite font matching rules.
+  const Face* selectFace(int family, const Layout& layout) const {
+    const Face* best = nullptr;
+    int best_score = 0;
+    const bool italic = layout.font_style != FontStyle::NORMAL;
+    for (int index : families_[family].faces) {
+      const FaceStyle& style = faces_[index]->face.style();
+      const int score = std::abs(style.weight - (int)layout.font_weight) +
+                        std::abs(style.stretch - (int)layout.font_stretch) * 100 +
+                        (style.italic != italic ? 10000 : 0);
+      if (best == nullptr || score < best_score) {
+        best = faces_[index].get();
+        best_score = score;
+      }
+    }
+    return best;
+  }
+
+  // Layout of |text| from the cache, built on a miss. The reference is
+  // valid until the next call.
+  const TextLayout& textLayout(SoftContext& ctx, const Layout& layout,
+      float dpi, std::u16string_view text) {
+    if (const TextLayout* cached =
+            ctx.layout_cache.find(LayoutKeyRef{text, &layout})) {
+      return *cached;
+    }
+    ctx.textlayout.reset();
+    createTextLayout(ctx, layout, dpi, text, ctx.textlayout);
+    const TextLayout* cached =
+        ctx.layout_cache.insert(LayoutKeyRef{text, &layout}, ctx.textlayout);
+    return cached ? *cached : ctx.textlayout;
+  }
+
+  // Face of every family matching the Layout font attributes, interned per
+  // TextFormatKey.
+  const std::vector<const Face*>& textFormat(
+      SoftContext& ctx, const Layout& layout) {
+    const TextFormatKey key(layout);
+    auto it = ctx.textformats.find(key);
+    if (it != ctx.textformats.end()) {
+      return it->second;
+    }
+    std::vector<const Face*> faces(families_.size());
+    for (int i = 0; i < (int)families_.size(); ++i) {
+      faces[i] = selectFace(i, layout);
+    }
+    return ctx.textformats.emplace(key, std::move(faces)).first->second;
+  }
+
+  // Glyph of |c| in the primary face, else in the first fallback whose
+  // ranges cover it. Leaves glyph 0 of the primary face if none has it.
+  void mapCodepoint(uint32_t c, const std::vector<const Face*>& faces,
+      GlyphItem& item) const {
+    item.face = faces[0];
+    item.glyph = faces[0]->face.glyphIndex(c);
+    if (item.glyph != 0) {
+      return;
+    }
+    for (const Fallback& fallback : fallbacks_) {
+      const bool in_range = std::any_of(fallback.ranges.begin(),
+          fallback.ranges.end(),
+          [c](const std::pair<uint32_t, uint32_t>& range) {
+            return c >= range.first && c <= range.second;
+          });
+      if (!in_range) {
+        continue;
+      }
+      const uint16_t glyph = faces[fallback.family]->face.glyphIndex(c);
+      if (glyph != 0) {
+        item.face = faces[fallback.family];
+        item.glyph = glyph;
+        return;
+      }
+    }
+  }
+
+  void createTextLayout(SoftContext& ctx, const Layout& layout, float dpi,
+      std::u16string_view text, TextLayout& out) {
+    out.em = layout.font_size / (dpi / 96.0f);
+
+    const std::vector<const Face*>& faces = textFormat(ctx, layout);
+    const Face* primary = faces[0];
+
+    // Map codepoints to glyphs, breaking lines as we go.
+    const float max_width = layout.max_width;
+    const WordWrapMode mode = layout.word_wrap_mode;
+    Line line;
+    float pen = 0.0f;
+    size_t last_break = 0;  // first glyph after the last break opportunity
+    auto finish_line = [&](size_t end) {
+      line.end = end;
+      out.lines.push_back(line);
+      line = Line();
+      line.begin = end;
+      last_break = end;
+    };
+
+    for (size_t i = 0; i < text.size(); ++i) {
+      uint32_t c = text[i];
+      if (c >= 0xd800 && c < 0xdc00 && i + 1 < text.size() &&
+          text[i + 1] >= 0xdc00 && text[i + 1] < 0xe000) {
+        c = 0x10000 + ((c - 0xd800) << 10) + (text[++i] - 0xdc00);
+      }
+      if (is_newline(c)) {
+        if (c == '\r' && i + 1 < text.size() && text[i + 1] == '\n') {
+          ++i;
+        }
+        finish_line(out.glyphs.size());
+        pen = 0.0f;
+        continue;
+      }
+
+      GlyphItem item;
+      item.codepoint = c;
+      mapCodepoint(c, faces, item);
+      if (i + 1 < text.size()) {
+        uint32_t next = text[i + 1];
+        size_t next_end = i + 1;
+        if (next >= 0xd800 && next < 0xdc00 && i + 2 < text.size()) {
+          next = 0x10000 + ((next - 0xd800) << 10) + (text[i + 2] - 0xdc00);
+          next_end = i + 2;
+        }
+        if (is_variation_selector(next)) {
+          const uint16_t glyph = item.face->face.variantGlyphIndex(c, next);
+          if (glyph != 0) {
+            item.glyph = glyph;
+          }
+          i = next_end;
+        }
+      }
+      if (c == '\t') {
+        const float tab = out.em * 4.0f;
+        item.advance = (std::floor(pen / tab) + 1.0f) * tab - pen;
+      } else if (c < 0x20) {
+        item.advance = 0.0f;
+      } else {
+        const FontFace& ff = item.face->face;
+        item.advance = ff.advanceWidth(item.glyph) * out.em / ff.unitsPerEm();
+      }
+
+      const size_t index = out.glyphs.size();
+      if (!is_whitespace(c) && pen + item.advance > max_width &&
+          index > line.begin && mode != WordWrapMode::NO_WRAP) {
+        size_t next = index;
+        if (mode != WordWrapMode::CHARACTER && last_break > line.begin) {
+          next = last_break;
+        } else if (mode == WordWrapMode::WHOLE_WORD) {
+          next = SIZE_MAX;
+        }
+        if (next != SIZE_MAX) {
+          const float shift = next < index ? out.glyphs[next].x : pen;
+          for (size_t j = next; j < index; ++j) {
+            out.glyphs[j].x -= shift;
+          }
+          pen -= shift;
+          finish_line(next);
+        }
+      }
+      if (is_ideographic(c) && index > line.begin) {
+        last_break = index;
+      }
+
+      item.x = pen;
+      pen += item.advance;
+      out.glyphs.push_back(item);
+      if (is_whitespace(c) || c == '-' || is_ideographic(c)) {
+        last_break = index + 1;
+      }
+    }
+    finish_line(out.glyphs.size());
+    measureLines(primary, out);
+  }
+
+  // Glyphs are taken as-is, on one line in the face chosen by |layout|.
+  void createGlyphRunLayout(SoftContext& ctx, const GlyphRun& glyphrun,
+      const Layout& layout, float dpi, TextLayout& out) {
+    const int family = glyphrun.font_index < (int)font_families_.size()
+                           ? font_families_[glyphrun.font_index]
+                           : -1;
+    if (family < 0) {
+      throw Error(Status::FONT_NOT_FOUND, "font not found.");
+    }
+    out.em = layout.font_size / (dpi / 96.0f);
+    const Face* face = textFormat(ctx, layout)[family];
+    const FontFace& ff = face->face;
+    const float scale = out.em / ff.unitsPerEm();
+    const int num_glyphs = ff.numGlyphs();
+
+    float pen = 0.0f;
+    out.glyphs.resize(glyphrun.glyph_count);
+    for (uint32_t i = 0; i < glyphrun.glyph_count; ++i) {
+      GlyphItem& item = out.glyphs[i];
+      item.face = face;
+      item.glyph = glyphrun.glyph_indices[i] < num_glyphs
+                       ? glyphrun.glyph_indices[i]
+                       : 0;
+      item.x = pen;
+      item.advance = glyphrun.glyph_advances
+                         ? glyphrun.glyph_advances[i]
+                         : ff.advanceWidth(item.glyph) * scale;
+      if (glyphrun.glyph_offsets) {
+        item.x += glyphrun.glyph_offsets[i].advance_offset;
+        item.y = -glyphrun.glyph_offsets[i].ascender_offset;
+      }
+      pen += item.advance;
+    }
+    Line line;
+    line.end = out.glyphs.size();
+    out.lines.push_back(line);
+    measureLines(face, out);
+    out.width = std::min(std::max(pen, 0.0f), (float)kMaxLayoutSize);
+  }
+
+  // Vertical metrics and ink bounds.
+  void measureLines(const Face* primary, TextLayout& out) {
+    float top = 0.0f;
+    bool has_ink = false;
+    for (Line& line : out.lines) {
+      float ascent = 0.0f;
+      float descent = 0.0f;
+      float gap = 0.0f;
+      auto add_face = [&](const Face* face) {
+        const FontFace& ff = face->face;
+        const float scale = out.em / ff.unitsPerEm();
+        ascent = std::max(ascent, ff.ascent() * scale);
+        descent = std::max(descent, ff.descent() * scale);
+        gap = std::max(gap, ff.lineGap() * scale);
+      };
+      add_face(primary);
+      line.width = 0.0f;
+      for (size_t i = line.begin; i < line.end; ++i) {
+        const GlyphItem& item = out.glyphs[i];
+        add_face(item.face);
+        if (!is_whitespace(item.codepoint)) {
+          line.width = item.x + item.advance;
+        }
+      }
+      line.top = top;
+      line.baseline = top + ascent;
+      line.height = ascent + descent + gap;
+      top += line.height;
+      out.width = std::max(out.width, line.width);
+
+      for (size_t i = line.begin; i < line.end; ++i) {
+        const GlyphItem& item = out.glyphs[i];
+        GlyphBounds bounds;
+        if (!item.face->face.glyphBounds(item.glyph, bounds) ||
+            bounds.empty()) {
+          continue;
+        }
+        const float scale = out.em / item.face->face.unitsPerEm();
+        const float l = item.x + bounds.x_min * scale;
+        const float r = item.x + bounds.x_max * scale;
+        const float t = line.baseline + item.y - bounds.y_max * scale;
+        const float b = line.baseline + item.y - bounds.y_min * scale;
+        out.ink_left = has_ink ? std::min(out.ink_left, l) : l;
+        out.ink_top = has_ink ? std::min(out.ink_top, t) : t;
+        out.ink_right = has_ink ? std::max(out.ink_right, r) : r;
+        out.ink_bottom = has_ink ? std::max(out.ink_bottom, b) : b;
+        has_ink = true;
+      }
+    }
+    out.height = top;
+    out.width = std::min(out.width, (float)kMaxLayoutSize);
+    out.height = std::min(out.height, (float)kMaxLayoutSize);
+  }
+
+  bool calcSize(const TextLayout& textlayout, Layout& layout) {
+    // Same arithmetic as the DirectWrite backend, with the overhang derived
+    // from the ink bounds relative to the max_width x max_height box.
+    const float overhang_left = -textlayout.ink_left;
+    const float overhang_top = -textlayout.ink_top;
+    const float overhang_right = textlayout.ink_right - layout.max_width;
+    const float overhang_bottom = textlayout.ink_bottom - layout.max_height;
+
+    const size_t required_size = (int)(textlayout.width + 0.5f) * 4 *
+                                 (int)(textlayout.height + 0.5f);
+    layout.out_buffer_size = (int)required_size;
+    layout.out_width = (int)(textlayout.width + 0.5f);
+    layout.out_height = (int)(textlayout.height + 0.5f);
+    layout.out_padding_top = (int)(-std::min(0.0f, overhang_top));
+    layout.out_padding_left = (int)(-std::min(0.0f, overhang_left));
+    layout.out_padding_right = layout.out_width - (int)(layout.max_width + overhang_right);
+    layout.out_padding_bottom = layout.out_height - (int)(layout.max_height + overhang_bottom);
+    if (!textlayout.lines.empty()) {
+      layout.out_baseline =
+          (int)(textlayout.lines.front().baseline - overhang_top + 0.5f);
+    }
+    return true;
+  }
+
+  // One per call in flight.
+  mutable ContextPool<SoftContext> contexts_{[this] {
+    auto context = std::make_unique<SoftContext>();
+    context->glyph_cache.setBudget(glyph_cache_budget_);
+    context->layout_cache.setCapacity(layout_cache_capacity_);
+    return context;
+  }};
+  size_t glyph_cache_budget_ = kDefaultGlyphCacheBudget;
+  size_t layout_cache_capacity_ = kDefaultLayoutCacheCapacity;
+  std::mutex init_mutex_;
+  std::atomic<bool> initialized_ = false;
+  std::exception_ptr init_error_;  // guarded by init_mutex_
+
+  // Read-only once init() returns, so calls share them without locking.
+  std::vector<std::unique_ptr<Face>> faces_;
+  std::vector<Family> families_;
+  std::vector<int> font_families_;  // FontSet::fonts index -> families_
+  std::vector<Fallback> fallbacks_;
+  std::vector<std::pair<std::string, std::unique_ptr<std::vector<uint8_t>>>>
+      files_;
+};
+
+std::unique_ptr<SimpleDWriteImpl> CreateSoftImpl() {
+  return std::make_unique<SoftImpl>();
+}
+
+}  // namespace simpledwrite
@@ -0,0 +1,170 @@
+#include "simpledwrite_threadpool.h"
+
+#include <algorithm>
+#include <exception>
+
+#ifdef _WIN32
+#include <combaseapi.h>
+#endif
+
+namespace simpledwrite {
+
+namespace {
+
+// Pool and queue index of the current worker thread.
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local size_t current_index = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(unsigned threads) {
+  threads = std::max(1u, threads);
+  for (unsigned i = 0; i < threads; ++i) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
+  for (unsigned i = 0; i < threads; ++i) {
+    threads_.emplace_back([this, i] { work(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  const size_t index = current_pool == this
+                           ? current_index
+                           : next_.fetch_add(1) % queues_.size();
+  ++queued_;
+  {
+    std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(std::move(task));
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  wake_.notify_one();
+}
+
+void ThreadPool::parallelFor(
+    size_t count, const std::function<void(size_t)>& func) {
+  if (count == 0) {
+    return;
+  }
+  // Chunks are claimed from a counter by the caller and by helper tasks on
+  // the workers, so the caller only ever runs its own work. Helpers that
+  // start late find nothing left and return; the group outlives them.
+  struct Group {
+    std::atomic<size_t> next = 0;
+    size_t chunks = 0;
+    size_t count = 0;
+    const std::function<void(size_t)>* func = nullptr;
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t remaining = 0;
+    std::exception_ptr error;
+
+    // Runs chunks until none are left to claim.
+    void run() {
+      for (;;) {
+        const size_t chunk = next.fetch_add(1);
+        if (chunk >= chunks) {
+          return;
+        }
+        const size_t begin = count * chunk / chunks;
+        const size_t end = count * (chunk + 1) / chunks;
+        std::exception_ptr chunk_error;
+        for (size_t i = begin; i < end; ++i) {
+          try {
+            (*func)(i);
+          } catch (...) {
+            if (!chunk_error) {
+              chunk_error = std::current_exception();
+            }
+          }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (chunk_error && !error) {
+          error = chunk_error;
+        }
+        if (--remaining == 0) {
+          done.notify_all();
+        }
+      }
+    }
+  };
+  auto group = std::make_shared<Group>();
+  // A few chunks per thread leave something to balance at the end.
+  group->chunks = std::min(count, (size_t)(size() + 1) * 4);
+  group->count = count;
+  group->func = &func;
+  group->remaining = group->chunks;
+  const size_t helpers = std::min((size_t)size(), group->chunks - 1);
+  for (size_t i = 0; i < helpers; ++i) {
+    submit([group] { group->run(); });
+  }
+
+  group->run();
+  std::unique_lock<std::mutex> lock(group->mutex);
+  group->done.wait(lock, [&group] { return group->remaining == 0; });
+  if (group->error) {
+    std::rethrow_exception(group->error);
+  }
+}
+
+bool ThreadPool::runOne(size_t home) {
+  const size_t count = queues_.size();
+  for (size_t i = 0; i < count; ++i) {
+    Queue& queue = *queues_[(home + i) % count];
+    std::function<void()> task;
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty()) {
+        continue;
+      }
+      // Newest from the own queue, oldest when stealing.
+      if (i == 0) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      } else {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+    }
+    --queued_;
+    task();
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::work(size_t index) {
+  current_pool = this;
+  current_index = index;
+#ifdef _WIN32
+  // WIC and Direct2D objects are used from the workers.
+  const HRESULT hr = ::CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+#endif
+  for (;;) {
+    if (runOne(index)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+    if (stop_ && queued_ == 0) {
+      break;
+    }
+  }
+#ifdef _WIN32
+  if (SUCCEEDED(hr)) {
+    ::CoUninitialize();
+  }
+#endif
+}
+
+}  // namespace simpledwrite
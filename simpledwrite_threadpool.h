@@ -0,0 +1,58 @@
+#pragma once
+
+// simpledwrite work-stealing thread pool
+// https://github.com/fecf/simpledwrite
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace simpledwrite {
+
+// Each worker runs tasks from the back of its own queue and, when that is
+// empty, steals from the front of the others, so uneven tasks balance out.
+class ThreadPool {
+ public:
+  // |threads| workers, at least one.
+  explicit ThreadPool(unsigned threads);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Queues |task| on the current worker, or round robin from other threads.
+  void submit(std::function<void()> task);
+  // Calls func(i) for every i in [0, count) on the workers and the calling
+  // thread, returning when all are done. The calling thread runs no other
+  // queued tasks meanwhile. The first exception thrown is rethrown here
+  // after the rest finish.
+  void parallelFor(size_t count, const std::function<void(size_t)>& func);
+
+  unsigned size() const { return (unsigned)threads_.size(); }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // Runs one queued task, preferring |home|'s own queue. Returns false if
+  // every queue is empty.
+  bool runOne(size_t home);
+  void work(size_t index);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;  // guards stop_ and the wakeup
+  std::condition_variable wake_;
+  std::atomic<size_t> queued_ = 0;
+  std::atomic<size_t> next_ = 0;  // round robin for outside submits
+  bool stop_ = false;
+};
+
+}  // namespace simpledwrite
@@ -0,0 +1,156 @@
+#include "simpledwrite_utf.h"
+
+#include <bit>
+#include <cstdint>
+
+#if !defined(SIMPLEDWRITE_NO_SIMD) &&                                \
+    (defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SIMPLEDWRITE_SSE2 1
+#include <immintrin.h>
+#endif
+
+namespace simpledwrite {
+
+namespace {
+
+// Widens the ASCII prefix of [p, end) to |dst|, 16 bytes at a time, and
+// returns its length.
+size_t widen_ascii(const unsigned char* p, const unsigned char* end,
+    char16_t* dst) {
+  size_t n = 0;
+#ifdef SIMPLEDWRITE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  while (end - p - n >= 16) {
+    const __m128i bytes = _mm_loadu_si128((const __m128i*)(p + n));
+    const unsigned mask = (unsigned)_mm_movemask_epi8(bytes);
+    if (mask != 0) {
+      const unsigned ascii = (unsigned)std::countr_zero(mask);
+      for (unsigned i = 0; i < ascii; ++i) {
+        dst[n + i] = p[n + i];
+      }
+      return n + ascii;
+    }
+    _mm_storeu_si128((__m128i*)(dst + n), _mm_unpacklo_epi8(bytes, zero));
+    _mm_storeu_si128((__m128i*)(dst + n + 8), _mm_unpackhi_epi8(bytes, zero));
+    n += 16;
+  }
+#endif
+  while (p + n < end && p[n] < 0x80) {
+    dst[n] = p[n];
+    ++n;
+  }
+  return n;
+}
+
+}  // namespace
+
+void utf8_to_u16(std::string_view str, std::u16string& out) {
+  // Never more code units than bytes.
+  out.resize(str.size());
+  char16_t* dst = out.data();
+  const unsigned char* p = (const unsigned char*)str.data();
+  const unsigned char* end = p + str.size();
+  while (p < end) {
+    uint32_t c = *p;
+    if (c < 0x80) {
+      const size_t n = widen_ascii(p, end, dst);
+      p += n;
+      dst += n;
+      continue;
+    }
+    ++p;
+    int extra = 0;
+    if (c >= 0xf0 && c <= 0xf4) {
+      c &= 0x07;
+      extra = 3;
+    } else if (c >= 0xe0 && c < 0xf0) {
+      c &= 0x0f;
+      extra = 2;
+    } else if (c >= 0xc2 && c < 0xe0) {
+      c &= 0x1f;
+      extra = 1;
+    } else {
+      *dst++ = 0xfffd;
+      continue;
+    }
+    bool valid = end - p >= extra;
+    for (int i = 0; valid && i < extra; ++i) {
+      if ((p[i] & 0xc0) != 0x80) {
+        valid = false;
+        break;
+      }
+      c = (c << 6) | (p[i] & 0x3f);
+    }
+    if (!valid || (extra == 2 && (c < 0x800 || (c >= 0xd800 && c < 0xe000))) ||
+        (extra == 3 && (c < 0x10000 || c > 0x10ffff))) {
+      // Resume right after the lead byte.
+      *dst++ = 0xfffd;
+      continue;
+    }
+    p += extra;
+    if (c >= 0x10000) {
+      c -= 0x10000;
+      *dst++ = (char16_t)(0xd800 + (c >> 10));
+      *dst++ = (char16_t)(0xdc00 + (c & 0x3ff));
+    } else {
+      *dst++ = (char16_t)c;
+    }
+  }
+  out.resize(dst - out.data());
+}
+
+std::u16string utf8_to_u16(std::string_view str) {
+  std::u16string out;
+  utf8_to_u16(str, out);
+  return out;
+}
+
+std::string u16_to_utf8(std::u16string_view str) {
+  std::string out;
+  out.reserve(str.size());
+  for (size_t i = 0; i < str.size(); ++i) {
+    uint32_t c = str[i];
+    if (c >= 0xd800 && c < 0xdc00 && i + 1 < str.size() &&
+        str[i + 1] >= 0xdc00 && str[i + 1] < 0xe000) {
+      c = 0x10000 + ((c - 0xd800) << 10) + (str[++i] - 0xdc00);
+    } else if (c >= 0xd800 && c < 0xe000) {
+      c = 0xfffd;
+    }
+    if (c < 0x80) {
+      out.push_back((char)c);
+    } else if (c < 0x800) {
+      out.push_back((char)(0xc0 | (c >> 6)));
+      out.push_back((char)(0x80 | (c & 0x3f)));
+    } else if (c < 0x10000) {
+      out.push_back((char)(0xe0 | (c >> 12)));
+      out.push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+      out.push_back((char)(0x80 | (c & 0x3f)));
+    } else {
+      out.push_back((char)(0xf0 | (c >> 18)));
+      out.push_back((char)(0x80 | ((c >> 12) & 0x3f)));
+      out.push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+      out.push_back((char)(0x80 | (c & 0x3f)));
+    }
+  }
+  return out;
+}
+
+void u32_to_u16(std::u32string_view str, std::u16string& out) {
+  out.resize(str.size() * 2);
+  char16_t* dst = out.data();
+  for (char32_t c : str) {
+    if (c >= 0x10000 && c <= 0x10ffff) {
+      c -= 0x10000;
+      *dst++ = (char16_t)(0xd800 + (c >> 10));
+      *dst++ = (char16_t)(0xdc00 + (c & 0x3ff));
+    } else if (c > 0x10ffff || (c >= 0xd800 && c < 0xe000)) {
+      *dst++ = 0xfffd;
+    } else {
+      *dst++ = (char16_t)c;
+    }
+  }
+  out.resize(dst - out.data());
+}
+
+}  // namespace simpledwrite
@@ -0,0 +1,20 @@
+#pragma once
+
+// simpledwrite UTF-8 / UTF-16 conversion
+// https://github.com/fecf/simpledwrite
+
+#include <string>
+#include <string_view>
+
+namespace simpledwrite {
+
+// Decodes |str| into |out|, reusing its storage. Malformed input decodes to
+// U+FFFD.
+void utf8_to_u16(std::string_view str, std::u16string& out);
+std::u16string utf8_to_u16(std::string_view str);
+std::string u16_to_utf8(std::u16string_view str);
+// Encodes |str| into |out|, reusing its storage. Surrogates and values past
+// U+10FFFF become U+FFFD.
+void u32_to_u16(std::u32string_view str, std::u16string& out);
+
+}  // namespace simpledwrite
@@ -0,0 +1,115 @@
+// Checks that warm Render, RenderInto and CalcSize calls on the software
+// backend do not allocate, on layout and glyph cache hits and misses alike.
+
+#include "simpledwrite.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<long> allocations{0};
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++allocations;
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+using namespace simpledwrite;
+
+namespace {
+
+int failures = 0;
+
+struct Target {
+  std::vector<uint8_t> buffer = std::vector<uint8_t>(1 << 22);
+  std::vector<uint8_t> pixels = std::vector<uint8_t>(512 * 512 * 4);
+  Surface surface;
+
+  Target() {
+    surface.data = pixels.data();
+    surface.width = 512;
+    surface.height = 512;
+    surface.stride = 512 * 4;
+  }
+};
+
+// Measures and renders each of |texts| plainly, outlined in A8 and into a
+// surface.
+bool run(const SimpleDWrite& dw, const std::vector<std::string>& texts,
+    Target& target) {
+  bool ok = true;
+  for (const std::string& text : texts) {
+    Layout layout(20);
+    layout.max_width = 150;
+    ok &= dw.CalcSize(text, layout);
+    ok &= dw.Render(
+        text, target.buffer.data(), (int)target.buffer.size(), layout);
+    RenderParams renderparams;
+    renderparams.outline_width = 2;
+    renderparams.pixel_format = PixelFormat::A8;
+    ok &= dw.Render(text, target.buffer.data(), (int)target.buffer.size(),
+        layout, renderparams);
+    ok &= dw.RenderInto(text, target.surface, 10, 10, layout, renderparams);
+  }
+  return ok;
+}
+
+void check(const char* name, const SimpleDWrite& dw,
+    const std::vector<std::string>& texts) {
+  Target target;
+  for (int i = 0; i < 5; ++i) {
+    run(dw, texts, target);
+  }
+  allocations = 0;
+  const bool ok = run(dw, texts, target) && run(dw, texts, target);
+  const long count = allocations;
+  if (!ok || count != 0) {
+    std::printf("FAIL: %s: ok=%d, %ld allocations\n", name, ok, count);
+    ++failures;
+  }
+}
+
+}  // namespace
+
+int main() {
+  SimpleDWrite dw(Backend::SOFTWARE);
+  if (!dw.Init(FontSet::Default())) {
+    std::printf("FAIL: Init: %s\n", dw.GetLastError().c_str());
+    return 1;
+  }
+  std::vector<std::string> texts;
+  for (int i = 0; i < 8; ++i) {
+    texts.push_back("Line number " + std::to_string(i * 7919) +
+        " with some words to wrap here");
+  }
+
+  // Every layout stays cached.
+  check("cache hits", dw, texts);
+
+  // Eight texts through three entries: every call misses and evicts.
+  dw.SetLayoutCacheCapacity(3);
+  check("cache misses", dw, texts);
+
+  // A few masks' worth of budget: glyphs miss and evict on every call too.
+  dw.SetGlyphCacheBudget(4096);
+  check("glyph cache misses", dw, texts);
+
+  std::printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
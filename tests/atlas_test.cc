@@ -0,0 +1,128 @@
+// Fills a small DynamicAtlas page with random frames until glyphs are
+// evicted and the page is repacked, and checks that no two glyphs share
+// texels.
+
+#include "simpledwrite.h"
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace simpledwrite;
+
+namespace {
+
+void append_utf8(uint32_t c, std::string& out) {
+  if (c < 0x80) {
+    out.push_back((char)c);
+  } else if (c < 0x800) {
+    out.push_back((char)(0xc0 | (c >> 6)));
+    out.push_back((char)(0x80 | (c & 0x3f)));
+  } else {
+    out.push_back((char)(0xe0 | (c >> 12)));
+    out.push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+    out.push_back((char)(0x80 | (c & 0x3f)));
+  }
+}
+
+bool overlap(const AtlasGlyph& a, const AtlasGlyph& b) {
+  return a.page == b.page && a.x < b.x + b.width && b.x < a.x + a.width &&
+         a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+}  // namespace
+
+int main() {
+  SimpleDWrite dw(Backend::SOFTWARE);
+  if (!dw.Init(FontSet::Default())) {
+    std::printf("FAIL: Init: %s\n", dw.GetLastError().c_str());
+    return 1;
+  }
+
+  // Latin, Greek and Cyrillic letters.
+  std::vector<uint32_t> codepoints;
+  for (uint32_t c = 'A'; c <= 'Z'; ++c) {
+    codepoints.push_back(c);
+    codepoints.push_back(c + 0x20);
+  }
+  for (uint32_t c = 0x391; c <= 0x3a9; ++c) {
+    if (c != 0x3a2) {
+      codepoints.push_back(c);
+      codepoints.push_back(c + 0x20);
+    }
+  }
+  for (uint32_t c = 0x410; c <= 0x44f; ++c) {
+    codepoints.push_back(c);
+  }
+
+  AtlasParams params;
+  params.layout.font_size = 20;
+  params.page_width = 96;
+  params.page_height = 96;
+  DynamicAtlas atlas(params, 1);
+
+  int failures = 0;
+  int full = 0;
+  int repacks = 0;
+  std::mt19937 rng(1);
+  for (int frame = 0; frame < 2000 && failures == 0; ++frame) {
+    atlas.BeginFrame();
+    std::string text;
+    const int count = 1 + (int)(rng() % 30);
+    for (int i = 0; i < count; ++i) {
+      append_utf8(codepoints[rng() % codepoints.size()], text);
+    }
+    if (!dw.UpdateAtlas(text, atlas)) {
+      if (dw.GetLastStatus() != Status::ATLAS_FULL) {
+        std::printf("FAIL: frame %d: %s\n", frame, dw.GetLastError().c_str());
+        ++failures;
+      }
+      ++full;
+    }
+    for (const AtlasRect& rect : atlas.DirtyRects()) {
+      if (rect.width == params.page_width &&
+          rect.height == params.page_height) {
+        ++repacks;
+        break;
+      }
+    }
+
+    std::vector<AtlasGlyph> glyphs;
+    for (uint32_t c : codepoints) {
+      const AtlasGlyph* glyph = atlas.Find(c);
+      if (glyph && glyph->page >= 0) {
+        glyphs.push_back(*glyph);
+      }
+    }
+    for (size_t i = 0; i < glyphs.size(); ++i) {
+      const AtlasGlyph& a = glyphs[i];
+      if (a.x < 0 || a.y < 0 || a.x + a.width > params.page_width ||
+          a.y + a.height > params.page_height) {
+        std::printf("FAIL: frame %d: U+%04X outside the page\n", frame,
+            a.codepoint);
+        ++failures;
+      }
+      for (size_t j = i + 1; j < glyphs.size(); ++j) {
+        const AtlasGlyph& b = glyphs[j];
+        if (overlap(a, b)) {
+          std::printf(
+              "FAIL: frame %d: U+%04X [%d,%d %dx%d] overlaps U+%04X "
+              "[%d,%d %dx%d]\n",
+              frame, a.codepoint, a.x, a.y, a.width, a.height, b.codepoint,
+              b.x, b.y, b.width, b.height);
+          ++failures;
+        }
+      }
+    }
+  }
+  if (repacks == 0) {
+    std::printf("FAIL: the page was never repacked\n");
+    ++failures;
+  }
+
+  std::printf("%s (%llu evictions, %d repacks, %d full frames)\n",
+      failures ? "FAILED" : "OK", (unsigned long long)atlas.Evictions(),
+      repacks, full);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+// Checks the SSE2 UTF-8 decoder against the same source built without SIMD.
+
+#include "simpledwrite_utf.h"
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// The scalar decoder, in a namespace of its own.
+#define SIMPLEDWRITE_NO_SIMD
+#define simpledwrite simpledwrite_scalar
+#include "simpledwrite_utf.cc"
+#undef simpledwrite
+#undef SIMPLEDWRITE_NO_SIMD
+
+namespace {
+
+int failures = 0;
+
+std::string hex(std::string_view str) {
+  std::string out;
+  char buf[4];
+  for (unsigned char c : str) {
+    std::snprintf(buf, sizeof(buf), "%02x ", c);
+    out += buf;
+  }
+  return out;
+}
+
+// Decodes |str| with both paths, into reused and fresh strings, and
+// compares them with each other and, if given, with |expected|.
+void check(std::string_view str, const std::u16string* expected = nullptr) {
+  static std::u16string simd(64, u'x');
+  static std::u16string scalar(64, u'x');
+  simpledwrite::utf8_to_u16(str, simd);
+  simpledwrite_scalar::utf8_to_u16(str, scalar);
+  if (simd != scalar || simd != simpledwrite::utf8_to_u16(str) ||
+      (expected && simd != *expected)) {
+    std::printf("FAIL: %s\n", hex(str).c_str());
+    ++failures;
+  }
+}
+
+void expect(std::string_view str, std::u16string expected) {
+  check(str, &expected);
+}
+
+}  // namespace
+
+int main() {
+  // ASCII runs of every length up to three blocks, at every offset, so that
+  // the 16-byte loads straddle the non-ASCII byte in every position.
+  for (size_t before = 0; before < 48; ++before) {
+    for (size_t after = 0; after < 48; after += 7) {
+      const std::string head(before, 'a');
+      const std::string tail(after, 'z');
+      expect(head + tail,
+          std::u16string(before, u'a') + std::u16string(after, u'z'));
+      expect(head + "\xc3\xa9" + tail, std::u16string(before, u'a') + u"\u00e9" +
+          std::u16string(after, u'z'));
+      expect(head + "\xff" + tail, std::u16string(before, u'a') + u"\ufffd" +
+          std::u16string(after, u'z'));
+    }
+  }
+
+  // Every sequence length, at its lowest and highest value.
+  expect("\x7f", u"\u007f");
+  expect("\xc2\x80", u"\u0080");
+  expect("\xdf\xbf", u"\u07ff");
+  expect("\xe0\xa0\x80", u"\u0800");
+  expect("\xef\xbf\xbf", u"\uffff");
+  expect("\xf0\x90\x80\x80", u"\U00010000");
+  expect("\xf4\x8f\xbf\xbf", u"\U0010ffff");
+
+  // Surrogate pairs out; encoded surrogates in are rejected.
+  expect("\xf0\x9f\x98\x80", u"\U0001f600");
+  expect("\xed\xa0\x80", u"\ufffd\ufffd\ufffd");
+  expect("\xed\xbf\xbf", u"\ufffd\ufffd\ufffd");
+  expect("\xed\x9f\xbf", u"\ud7ff");
+
+  // Overlong forms, and values past U+10FFFF.
+  expect("\xc0\xaf", u"\ufffd\ufffd");
+  expect("\xc1\xbf", u"\ufffd\ufffd");
+  expect("\xe0\x80\xaf", u"\ufffd\ufffd\ufffd");
+  expect("\xe0\x9f\xbf", u"\ufffd\ufffd\ufffd");
+  expect("\xf0\x80\x80\xaf", u"\ufffd\ufffd\ufffd\ufffd");
+  expect("\xf0\x8f\xbf\xbf", u"\ufffd\ufffd\ufffd\ufffd");
+  expect("\xf4\x90\x80\x80", u"\ufffd\ufffd\ufffd\ufffd");
+
+  // Lead bytes that never start a sequence.
+  for (int c = 0xf5; c <= 0xff; ++c) {
+    expect(std::string(1, (char)c) + "a", u"\ufffda");
+    expect(std::string(1, (char)c) + "\x80\x80\x80", u"\ufffd\ufffd\ufffd\ufffd");
+  }
+
+  // Truncated sequences at the end and in the middle.
+  expect("a\xc3", u"a\ufffd");
+  expect("a\xe3\x81", u"a\ufffd\ufffd");
+  expect("a\xf0\x9f\x98", u"a\ufffd\ufffd\ufffd");
+  expect("\xe3" "A", u"\ufffdA");
+  expect("\xe3\x81" "A", u"\ufffd\ufffdA");
+  expect("\xf0\x9f\x98" "A\xc3\xa9", u"\ufffd\ufffd\ufffdA\u00e9");
+  expect("\xf0\x9f\x98\xf0\x9f\x98\x80", u"\ufffd\ufffd\ufffd\U0001f600");
+
+  // Random mixes of the above, mostly ASCII so that blocks still form.
+  const std::vector<std::string> pieces = {
+      "a", "0123456789abcdef", "\xc3\xa9", "\xe6\x97\xa5", "\xf0\x9f\x98\x80",
+      "\xed\xa0\x80", "\xc0\xaf", "\xf5", "\xff", "\x80", "\xe3", "\xf0\x9f"};
+  std::mt19937 rng(1);
+  for (int i = 0; i < 100000; ++i) {
+    std::string str;
+    const int count = (int)(rng() % 24);
+    for (int j = 0; j < count; ++j) {
+      str += pieces[rng() % 4 == 0 ? rng() % pieces.size() : rng() % 2];
+    }
+    check(str);
+  }
+  for (int i = 0; i < 100000; ++i) {
+    std::string str(rng() % 80, '\0');
+    for (char& c : str) {
+      c = (char)(rng() % 4 == 0 ? rng() % 256 : rng() % 128);
+    }
+    check(str);
+  }
+
+  std::printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}